@@ -517,12 +517,20 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// decode JPEGs at 1/2, 1/4 or 1/8 of their size (pass 2, 4 or 8; 1 restores
+// full size). the reduction happens in the DCT domain: only the low-frequency
+// corner of each block is transformed, so a smaller decode also costs less.
+// the reported width and height are the scaled ones, rounded up. other
+// formats are unaffected.
+STBIDEF void stbi_set_jpeg_scale_on_load(int scale_denominator);
+
 // as above, but only applies to images loaded on the thread that calls the function
 // this function is only available if your compiler supports thread-local variables;
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply);
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int scale_denominator);
 
 // ZLIB client - used by PNG, available for other purposes
 
@@ -1134,6 +1142,34 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__jpeg_scale_shift_for(int scale_denominator)
+{
+   return scale_denominator >= 8 ? 3 : scale_denominator >= 4 ? 2 : scale_denominator >= 2 ? 1 : 0;
+}
+
+static int stbi__jpeg_scale_shift_global = 0;
+
+STBIDEF void stbi_set_jpeg_scale_on_load(int scale_denominator)
+{
+   stbi__jpeg_scale_shift_global = stbi__jpeg_scale_shift_for(scale_denominator);
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_scale_shift  stbi__jpeg_scale_shift_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_scale_shift_local, stbi__jpeg_scale_shift_set;
+
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int scale_denominator)
+{
+   stbi__jpeg_scale_shift_local = stbi__jpeg_scale_shift_for(scale_denominator);
+   stbi__jpeg_scale_shift_set = 1;
+}
+
+#define stbi__jpeg_scale_shift  (stbi__jpeg_scale_shift_set       \
+                                 ? stbi__jpeg_scale_shift_local   \
+                                 : stbi__jpeg_scale_shift_global)
+#endif // STBI_THREAD_LOCAL
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1994,6 +2030,9 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+// log2 of the scale-down factor; blocks decode to (8 >> scale_shift) pixels square
+   int scale_shift;
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -2523,6 +2562,54 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced-size IDCT: the n x n lowest frequencies of an 8x8 block, through an
+// n-point IDCT, give the block downsampled to n x n (n = 1, 2 or 4). with
+// orthonormal DCTs the n/8 rescale cancels the change of normalization, so
+// out = 1/4 * sum c(u)c(v) F(u,v) cos((2x+1)u pi/2n) cos((2y+1)v pi/2n).
+// coefficients outside the corner are never read.
+#define STBI__IDCT_4(s0,s1,s2,s3) \
+   e0 = ((s0) + (s2)) * 0.707106781f;                  \
+   e1 = ((s0) - (s2)) * 0.707106781f;                  \
+   o0 = (s1) * 0.923879533f + (s3) * 0.382683432f;     \
+   o1 = (s1) * 0.382683432f - (s3) * 0.923879533f;     \
+   t0 = e0 + o0;                                       \
+   t3 = e0 - o0;                                       \
+   t1 = e1 + o1;                                       \
+   t2 = e1 - o1;
+
+static void stbi__idct_block_scaled(stbi_uc *out, int out_stride, short data[64], int n)
+{
+   if (n == 1) {
+      // DC only: the block's mean, rounded
+      out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+   } else if (n == 2) {
+      // every basis product is +-1/2, so this is exact in integers
+      int a = data[0] + data[8], b = data[0] - data[8];
+      int c = data[1] + data[9], d = data[1] - data[9];
+      out[0]            = stbi__clamp(((a + c + 4) >> 3) + 128);
+      out[1]            = stbi__clamp(((a - c + 4) >> 3) + 128);
+      out[out_stride]   = stbi__clamp(((b + d + 4) >> 3) + 128);
+      out[out_stride+1] = stbi__clamp(((b - d + 4) >> 3) + 128);
+   } else {
+      float tmp[16], e0,e1,o0,o1,t0,t1,t2,t3;
+      int i;
+      // columns
+      for (i=0; i < 4; ++i) {
+         STBI__IDCT_4(data[i], data[8+i], data[16+i], data[24+i])
+         tmp[i] = t0; tmp[4+i] = t1; tmp[8+i] = t2; tmp[12+i] = t3;
+      }
+      // rows, folding in the 1/4 and the level shift
+      for (i=0; i < 4; ++i, out += out_stride) {
+         const float *r = tmp + i*4;
+         STBI__IDCT_4(r[0], r[1], r[2], r[3])
+         out[0] = stbi__clamp((int) (t0 * 0.25f + 128.5f));
+         out[1] = stbi__clamp((int) (t1 * 0.25f + 128.5f));
+         out[2] = stbi__clamp((int) (t2 * 0.25f + 128.5f));
+         out[3] = stbi__clamp((int) (t3 * 0.25f + 128.5f));
+      }
+   }
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2946,6 +3033,15 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// decoded blocks are 8 >> scale_shift pixels on a side
+static void stbi__jpeg_idct(stbi__jpeg *z, stbi_uc *out, int out_stride, short data[64])
+{
+   if (z->scale_shift == 0)
+      z->idct_block_kernel(out, out_stride, data);
+   else
+      stbi__idct_block_scaled(out, out_stride, data, 8 >> z->scale_shift);
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -2960,11 +3056,12 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          // component has, independent of interleaved MCU blocking and such
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
+         int bs = 8 >> z->scale_shift;
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2979,6 +3076,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
       } else { // interleaved
          int i,j,k,x,y;
          STBI_SIMD_ALIGN(short, data[64]);
+         int bs = 8 >> z->scale_shift;
          for (j=0; j < z->img_mcu_y; ++j) {
             for (i=0; i < z->img_mcu_x; ++i) {
                // scan an interleaved mcu... process scan_n components in order
@@ -2988,11 +3086,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x)*bs;
+                        int y2 = (j*z->img_comp[n].v + y)*bs;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
                      }
                   }
                }
@@ -3082,6 +3180,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
    if (z->progressive) {
       // dequantize and idct the data
       int i,j,n;
+      int bs = 8 >> z->scale_shift;
       for (n=0; n < z->s->img_n; ++n) {
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
@@ -3089,7 +3188,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
             }
          }
       }
@@ -3328,9 +3427,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // discard the extra data until colorspace conversion
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
-      // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      // so these muls can't overflow with 32-bit ints (which we require).
+      // a scaled decode writes (8 >> scale_shift)-pixel blocks, so the planes shrink
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3340,10 +3440,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         // coefficients are kept for every full-size block, whatever the scale
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3862,6 +3962,20 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+// the frame header and entropy decoding work in full-size units; once they are
+// done, switch the image and component sizes over to the scaled output
+static void stbi__jpeg_scale_size(stbi__jpeg *z)
+{
+   int i, bias = (1 << z->scale_shift) - 1;
+   if (z->scale_shift == 0) return;
+   z->s->img_x = (z->s->img_x + bias) >> z->scale_shift;
+   z->s->img_y = (z->s->img_y + bias) >> z->scale_shift;
+   for (i=0; i < z->s->img_n; ++i) {
+      z->img_comp[i].x = (z->img_comp[i].x + bias) >> z->scale_shift;
+      z->img_comp[i].y = (z->img_comp[i].y + bias) >> z->scale_shift;
+   }
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n, is_rgb;
@@ -3872,6 +3986,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+   stbi__jpeg_scale_size(z);
 
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
@@ -4033,6 +4148,7 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    memset(j, 0, sizeof(stbi__jpeg));
    STBI_NOTUSED(ri);
    j->s = s;
+   j->scale_shift = stbi__jpeg_scale_shift;
    stbi__setup_jpeg(j);
    result = load_jpeg_image(j, x,y,comp,req_comp);
    STBI_FREE(j);
@@ -4059,6 +4175,7 @@ static int stbi__jpeg_info_raw(stbi__jpeg *j, int *x, int *y, int *comp)
       stbi__rewind( j->s );
       return 0;
    }
+   stbi__jpeg_scale_size(j);
    if (x) *x = j->s->img_x;
    if (y) *y = j->s->img_y;
    if (comp) *comp = j->s->img_n >= 3 ? 3 : 1;
@@ -4072,6 +4189,7 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    if (!j) return stbi__err("outofmem", "Out of memory");
    memset(j, 0, sizeof(stbi__jpeg));
    j->s = s;
+   j->scale_shift = stbi__jpeg_scale_shift;
    result = stbi__jpeg_info_raw(j, x, y, comp);
    STBI_FREE(j);
    return result;
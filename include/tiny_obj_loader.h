@@ -690,6 +690,17 @@ bool ParseTextureNameAndOption(std::string *texname, texture_option_t *texopt,
 
 #endif  // TINYOBJLOADER_USE_MAPBOX_EARCUT
 
+// Define TINYOBJLOADER_USE_FAST_REAL_PARSE to parse reals with an exact
+// fast path (8 digits at a time, one multiply or divide by a power of ten)
+// instead of the per-character loop. Numbers outside the fast path go to
+// std::from_chars when the standard library has it (C++17 <charconv>).
+#if defined(TINYOBJLOADER_USE_FAST_REAL_PARSE) && __cplusplus >= 201703L && \
+    defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
 namespace tinyobj {
 
 MaterialReader::~MaterialReader() {}
@@ -894,7 +905,8 @@ static inline int parseInt(const char **token) {
 //  - s >= s_end.
 //  - parse failure.
 //
-static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+static bool tryParseDoubleClassic(const char *s, const char *s_end,
+                                  double *result) {
   if (s >= s_end) {
     return false;
   }
@@ -1027,6 +1039,171 @@ fail:
   return false;
 }
 
+#if defined(TINYOBJLOADER_USE_FAST_REAL_PARSE)
+// Converts eight digit values (one per byte, first digit in the lowest
+// byte) into their decimal value.
+static inline unsigned long long parseEightDigits(unsigned long long chunk) {
+  chunk = (chunk * 10 + (chunk >> 8)) & 0x00FF00FF00FF00FFull;
+  chunk = (chunk * 100 + (chunk >> 16)) & 0x0000FFFF0000FFFFull;
+  return (chunk * 10000 + (chunk >> 32)) & 0xFFFFFFFFull;
+}
+
+// Counts trailing zero bits of a non-zero value.
+static inline int countTrailingZeros(unsigned long long value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(value);
+#else
+  int count = 0;
+  while (!(value & 1)) {
+    value >>= 1;
+    count++;
+  }
+  return count;
+#endif
+}
+
+// Accumulates the run of ASCII digits at `curr` into `mantissa`. Where eight
+// bytes are readable, the run length is found with a SWAR digit test and up
+// to eight digits are converted at once. Digits past the 19th are counted
+// but not accumulated.
+static inline const char *parseDigits(const char *curr, const char *s_end,
+                                      unsigned long long *mantissa,
+                                      int *digits) {
+  static const unsigned long long pow10_int[] = {
+      1ull,      10ull,      100ull,      1000ull,     10000ull,
+      100000ull, 1000000ull, 10000000ull, 100000000ull};
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && \
+                        __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  // Only full eight-byte loads are used; shorter tails are cheaper to scan
+  // one character at a time than to assemble byte by byte.
+  while (*digits <= 11 && s_end - curr >= 8) {
+    unsigned long long chunk;
+    memcpy(&chunk, curr, sizeof(chunk));
+    // Digits become 0..9; every other byte ends up >= 10 and sets the high
+    // bit of its lane.
+    chunk ^= 0x3030303030303030ull;
+    unsigned long long non_digit =
+        (((chunk & 0x7F7F7F7F7F7F7F7Full) + 0x7676767676767676ull) | chunk) &
+        0x8080808080808080ull;
+    int count = non_digit ? (countTrailingZeros(non_digit) >> 3) : 8;
+    if (count == 0) return curr;
+    unsigned long long value =
+        count == 8 ? parseEightDigits(chunk)
+                   : parseEightDigits(chunk << (8 * (8 - count)));
+    *mantissa = *mantissa * pow10_int[count] + value;
+    *digits += count;
+    curr += count;
+    if (count < 8) return curr;
+  }
+#else
+  (void)pow10_int;
+#endif
+  while (curr != s_end && IS_DIGIT(*curr)) {
+    if (*digits < 19) {
+      *mantissa = *mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+    }
+    (*digits)++;
+    curr++;
+  }
+  return curr;
+}
+
+// Same grammar as tryParseDoubleClassic. Numbers with at most 19 digits, a
+// mantissa below 2^53 and a decimal exponent within +-22 (every coordinate a
+// typical exporter writes) are converted with a single correctly rounded
+// multiply or divide. Everything else goes through std::from_chars. Both
+// give the correctly rounded double, which agrees with the classic loop
+// once it is cast to a float real_t (checked by `--bench-float` in the demo
+// app). Inputs the classic parser rejects (inf, nan, a dangling exponent)
+// are rejected here too.
+static bool tryParseDoubleFast(const char *s, const char *s_end,
+                               double *result) {
+  if (s >= s_end) {
+    return false;
+  }
+
+  const char *curr = s;
+  bool negative = false;
+  if (*curr == '+' || *curr == '-') {
+    negative = (*curr == '-');
+    curr++;
+  }
+  if (curr == s_end || (!IS_DIGIT(*curr) && *curr != '.')) {
+    return false;
+  }
+  const char *number_begin = curr;
+
+  unsigned long long mantissa = 0;
+  int digits = 0;
+  curr = parseDigits(curr, s_end, &mantissa, &digits);
+  int exponent10 = 0;
+  if (curr != s_end && *curr == '.') {
+    curr++;
+    int integer_digits = digits;
+    curr = parseDigits(curr, s_end, &mantissa, &digits);
+    exponent10 = -(digits - integer_digits);
+  }
+
+  if (curr != s_end && (*curr == 'e' || *curr == 'E')) {
+    curr++;
+    bool exp_negative = false;
+    if (curr != s_end && (*curr == '+' || *curr == '-')) {
+      exp_negative = (*curr == '-');
+      curr++;
+    }
+    if (curr == s_end || !IS_DIGIT(*curr)) {
+      return false;  // Empty E is not allowed.
+    }
+    int exponent = 0;
+    while (curr != s_end && IS_DIGIT(*curr)) {
+      if (exponent > (2147483647 / 10)) {
+        return false;  // Integer overflow, as in the classic parser.
+      }
+      exponent = exponent * 10 + (*curr - '0');
+      curr++;
+    }
+    exponent10 += exp_negative ? -exponent : exponent;
+  }
+
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  double value;
+  if (mantissa == 0 && digits <= 19) {
+    value = 0.0;
+  } else if (digits <= 19 && mantissa <= (1ull << 53) && exponent10 >= -22 &&
+             exponent10 <= 22) {
+    value = static_cast<double>(mantissa);
+    value = exponent10 < 0 ? value / pow10[-exponent10]
+                           : value * pow10[exponent10];
+  } else {
+#if defined(__cpp_lib_to_chars)
+    std::from_chars_result parsed = std::from_chars(
+        number_begin, curr, value, std::chars_format::general);
+    if (parsed.ec != std::errc()) {
+      return tryParseDoubleClassic(s, s_end, result);
+    }
+#else
+    (void)number_begin;
+    return tryParseDoubleClassic(s, s_end, result);
+#endif
+  }
+
+  *result = negative ? -value : value;
+  return true;
+}
+#endif
+
+static inline bool tryParseDouble(const char *s, const char *s_end,
+                                  double *result) {
+#if defined(TINYOBJLOADER_USE_FAST_REAL_PARSE)
+  return tryParseDoubleFast(s, s_end, result);
+#else
+  return tryParseDoubleClassic(s, s_end, result);
+#endif
+}
+
 static inline real_t parseReal(const char **token, double default_value = 0.0) {
   (*token) += strspn((*token), " \t");
   const char *end = (*token) + strcspn((*token), " \t\r");
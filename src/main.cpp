@@ -1,21 +1,71 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #define TINYOBJLOADER_IMPLEMENTATION
+#define TINYOBJLOADER_USE_FAST_REAL_PARSE
 #include "tiny_obj_loader.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tuple>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MIP_USE_SSE
+#define TRANSFORM_USE_SSE
+#endif
+
+#ifdef __AVX__
+#include <immintrin.h>
+#define TRANSFORM_USE_AVX
+#endif
+
+// Generated by tools/optimize_shaders.sh; see findOptimizedShader.
+#if __has_include("optimized_shaders.h")
+#include "optimized_shaders.h"
+#define HAVE_OPTIMIZED_SHADERS
+#endif
 
+// The scene shaders are compiled per feature set: buildShaderSource puts a
+// #define for each SHADER_* bit in front of these bodies. See
+// ShaderVariantCache.
 const char *vertexShaderSource = R"(
-#version 330 core
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
@@ -23,42 +73,119 @@ layout(location = 2) in vec2 aTexCoord;
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoord;
+#ifdef SHADOWS
 out vec4 FragPosLightSpace;
+#endif
 
+// Normals go through the upper 3x3 of the model matrix when the scale is
+// uniform (the fragment shader renormalizes), and otherwise through a
+// normal matrix the CPU computes once per object.
+#ifdef INSTANCED
+uniform mat4 models[MAX_INSTANCES];
+#ifndef UNIFORM_SCALE
+uniform mat3 normalMatrices[MAX_INSTANCES];
+#endif
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+#ifndef UNIFORM_SCALE
+uniform mat3 normalMatrix;
+#endif
+#endif
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+
+// Shared with every program through UBO binding points; see FrameUniforms
+// and LightUniforms for the CPU side.
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+layout (std140) uniform LightData
+{
+    mat4 lightSpaceMatrix;
+    vec3 lightPos;
+    vec3 lightColor;
+};
 
 void main()
 {
-    vec4 worldPos = model * vec4(aPos, 1.0);
+#ifdef INSTANCED
+    mat4 objectModel = models[gl_InstanceID];
+#ifdef UNIFORM_SCALE
+    mat3 objectNormal = mat3(objectModel);
+#else
+    mat3 objectNormal = normalMatrices[gl_InstanceID];
+#endif
+#else
+    mat4 objectModel = model;
+#ifdef UNIFORM_SCALE
+    mat3 objectNormal = mat3(model);
+#else
+    mat3 objectNormal = normalMatrix;
+#endif
+#endif
+    vec4 worldPos = objectModel * vec4(aPos * positionScale + positionOffset, 1.0);
     FragPos = worldPos.xyz;
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = objectNormal * aNormal;
     TexCoord = aTexCoord;
+#ifdef SHADOWS
     FragPosLightSpace = lightSpaceMatrix * worldPos;
+#endif
     
     gl_Position = projection * view * worldPos;
 }
 )";
 
 const char *fragmentShaderSource = R"(
-#version 330 core
 out vec4 FragColor;
 
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoord;
+#ifdef SHADOWS
 in vec4 FragPosLightSpace;
 
-uniform sampler2D texture1;
 uniform sampler2D shadowMap;
+#endif
+
+#ifdef TEXTURE
+uniform sampler2D texture1;
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+// Virtual texturing: pageTable has one RGBA8 texel per tile at each level,
+// holding the physical cache slot (rg) and level (b) of the finest resident
+// tile covering it.
+uniform sampler2D pageTable;
+uniform sampler2D physicalCache;
+uniform vec2 virtualSize;
+uniform int virtualLevels;
+uniform vec2 physicalCacheSize;
+
+const float TILE_SIZE = 128.0;
+const float TILE_BORDER = 1.0;
+#endif
 
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-uniform vec3 lightColor;
 uniform vec3 objectColor;
 
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+layout (std140) uniform LightData
+{
+    mat4 lightSpaceMatrix;
+    vec3 lightPos;
+    vec3 lightColor;
+};
+
+#ifdef SHADOWS
 float ShadowCalculation(vec4 fragPosLightSpace)
 {
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
@@ -76,6 +203,22 @@ float ShadowCalculation(vec4 fragPosLightSpace)
         
     return shadow;
 }
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+vec3 sampleVirtualTexture(vec2 uv)
+{
+    vec2 dx = dFdx(uv * virtualSize), dy = dFdy(uv * virtualSize);
+    float lod = floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)));
+    int level = int(clamp(lod, 0.0, float(virtualLevels - 1)));
+    vec2 levelTexel = fract(uv) * max(floor(virtualSize / exp2(float(level))), vec2(1.0));
+    vec4 entry = round(texelFetch(pageTable, ivec2(levelTexel / TILE_SIZE), level) * 255.0);
+
+    vec2 mappedTexel = fract(uv) * max(floor(virtualSize / exp2(entry.b)), vec2(1.0));
+    vec2 physical = entry.rg * (TILE_SIZE + 2.0 * TILE_BORDER) + TILE_BORDER + mod(mappedTexel, TILE_SIZE);
+    return textureLod(physicalCache, physical / physicalCacheSize, 0.0).rgb;
+}
+#endif
 
 void main()
 {
@@ -93,49 +236,185 @@ void main()
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
     vec3 specular = specularStrength * spec * lightColor;
     
+#ifdef SHADOWS
     float shadow = ShadowCalculation(FragPosLightSpace);
+#else
+    float shadow = 0.0;
+#endif
     
     vec3 lighting = ambient + (1.0 - shadow) * (diffuse + specular);
+#if defined(VIRTUAL_TEXTURE)
+    vec3 texColor = sampleVirtualTexture(TexCoord);
+#elif defined(TEXTURE)
     vec3 texColor = texture(texture1, TexCoord).rgb;
+#else
+    vec3 texColor = objectColor;
+#endif
     vec3 result = lighting * texColor;
     FragColor = vec4(result, 1.0);
 }
 )";
 
 const char *depthVertexShaderSource = R"(
-#version 330 core
 layout(location = 0) in vec3 aPos;
 uniform mat4 model;
-uniform mat4 lightSpaceMatrix;
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+layout (std140) uniform LightData
+{
+    mat4 lightSpaceMatrix;
+    vec3 lightPos;
+    vec3 lightColor;
+};
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    gl_Position = lightSpaceMatrix * model * vec4(aPos * positionScale + positionOffset, 1.0);
 }
 )";
 
 const char *depthFragmentShaderSource = R"(
-#version 330 core
 void main()
 {
     
 }
 )";
 
-struct Model {
-    unsigned int VAO, VBO, EBO;
+// Writes the virtual tile each fragment would sample (x, y, level, texture
+// id), or zero for fragments without a virtual texture. feedbackBias makes up
+// for the feedback target's lower resolution.
+const char *feedbackFragmentShaderSource = R"(
+out vec4 FragColor;
+
+in vec2 TexCoord;
+
+uniform int virtualTextureId;
+uniform vec2 virtualSize;
+uniform int virtualLevels;
+uniform float feedbackBias;
+
+const float TILE_SIZE = 128.0;
+
+void main()
+{
+    if (virtualTextureId == 0)
+    {
+        FragColor = vec4(0.0);
+        return;
+    }
+    vec2 dx = dFdx(TexCoord * virtualSize), dy = dFdy(TexCoord * virtualSize);
+    float lod = floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + feedbackBias);
+    int level = int(clamp(lod, 0.0, float(virtualLevels - 1)));
+    vec2 levelTexel = fract(TexCoord) * max(floor(virtualSize / exp2(float(level))), vec2(1.0));
+    FragColor = vec4(floor(levelTexel / TILE_SIZE), float(level), float(virtualTextureId)) / 255.0;
+}
+)";
+
+// Interleaved vertex layout: position (3), normal (3), texcoord (2).
+const int VERTEX_STRIDE = 8;
+
+struct MeshData {
+    std::vector<float> vertices;
     std::vector<unsigned int> indices;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
 };
 
-struct Renderable {
-    Model model;
-    unsigned int texture;
+// GPU-side vertex encodings. Compact attributes are decoded by the vertex
+// fetch hardware, except positions, which the vertex shader maps back from
+// [0, 1] with the mesh's positionScale / positionOffset.
+enum class PositionEncoding {
+    Float32,  // 12 bytes
+    Unorm16,  // 8 bytes (xyz + padding), normalized against the mesh bounds
+};
+
+enum class NormalEncoding {
+    Float32,   // 12 bytes
+    Snorm10,   // 4 bytes, GL_INT_2_10_10_10_REV
+};
+
+enum class TexcoordEncoding {
+    Float32,  // 8 bytes
+    Half16,   // 4 bytes
+};
+
+struct VertexLayout {
+    PositionEncoding position;
+    NormalEncoding normal;
+    TexcoordEncoding texcoord;
+};
+
+const VertexLayout FLOAT_VERTEX_LAYOUT = {PositionEncoding::Float32, NormalEncoding::Float32, TexcoordEncoding::Float32};
+const VertexLayout COMPACT_VERTEX_LAYOUT = {PositionEncoding::Unorm16, NormalEncoding::Snorm10, TexcoordEncoding::Half16};
+
+// Set per attribute with --position-format float|unorm16,
+// --normal-format float|snorm10 and --texcoord-format float|half, or all to
+// float with --float-vertices.
+VertexLayout vertexLayout = COMPACT_VERTEX_LAYOUT;
+
+struct Model {
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    unsigned int indexCount = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
 };
 
-unsigned int createShader(unsigned int type, const char *source)
+// On-disk layout of a .meshcache file: this header, then vertexCount
+// vertices already encoded in the vertexLayout the header names, then
+// indexCount indices of indexType, so a current cache is uploaded as
+// mapped. The source size and timestamp are recorded so a stale cache is
+// rebuilt, as is one written for another vertex layout. contentHash is
+// hashFileContents of the source, for asset dedupe on warm starts.
+const char MESH_CACHE_MAGIC[4] = {'M', 'S', 'H', 'C'};
+const uint32_t MESH_CACHE_VERSION = 5;
+
+// MeshCacheHeader::flags; a cache is only reused when its flags match the
+// processing the current run would apply.
+const uint32_t MESH_CACHE_OPTIMIZED = 1;
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    uint32_t vertexLayout;
+    uint32_t vertexStride;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t indexType;
+    uint32_t flags;
+    float boundsMin[3];
+    float boundsMax[3];
+    float positionScale[3];
+    float positionOffset[3];
+    uint64_t contentHash;
+};
+
+struct MappedFile {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+// Issues the compile without asking for its status; the status query is
+// what makes the driver finish the compile on the calling thread.
+unsigned int submitShader(unsigned int type, const char *source)
 {
     unsigned int shader = glCreateShader(type);
     glShaderSource(shader, 1, &source, NULL);
     glCompileShader(shader);
+    return shader;
+}
+
+void checkShaderCompiled(unsigned int shader)
+{
     int success;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success)
@@ -144,196 +423,7012 @@ unsigned int createShader(unsigned int type, const char *source)
         glGetShaderInfoLog(shader, 512, NULL, infoLog);
         std::cerr << "ERROR::SHADER::COMPILATION_FAILED\n" << infoLog << std::endl;
     }
-    return shader;
 }
 
-unsigned int createShaderProgram(const char *vertexSource, const char *fragmentSource)
+// KHR_parallel_shader_compile (or the ARB version) lets the driver compile
+// on its own threads and answer GL_COMPLETION_STATUS_KHR without blocking.
+const GLenum GL_COMPLETION_STATUS_KHR_VALUE = 0x91B1;
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// Set by detectParallelShaderCompile.
+bool parallelShaderCompile = false;
+
+void detectParallelShaderCompile()
+{
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads = nullptr;
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+        maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+        maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+    if (!maxThreads)
+        return;
+    // 0xFFFFFFFF leaves the thread count to the driver.
+    maxThreads(0xFFFFFFFFu);
+    parallelShaderCompile = true;
+}
+
+// Linked program binaries are kept in shadercache/ (relative to the working
+// directory, like assets/), one .progbin per program: this header, then the
+// driver's blob. The name is a hash of the sources and the driver string;
+// the header repeats both hashes so a stale or colliding file is recompiled.
+// Variants differ in their #define lines, so each has its own entry.
+const char PROGRAM_CACHE_MAGIC[4] = {'P', 'R', 'G', 'B'};
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+const char *PROGRAM_CACHE_DIRECTORY = "shadercache";
+
+struct ProgramCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t driverHash;
+    uint32_t binaryFormat;
+    uint32_t binarySize;
+};
+
+struct ProgramBinaryCache {
+    // Set by detectProgramBinarySupport; cleared with --no-program-cache.
+    bool enabled = true;
+    uint64_t driverHash = 0;
+    int loaded = 0;
+    int compiled = 0;
+    int rejected = 0;
+};
+
+ProgramBinaryCache programCache;
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t hashProgramSources(const char *vertexSource, const char *fragmentSource)
+{
+    // The terminator of the first source separates the two.
+    uint64_t hash = hashBytes(vertexSource, strlen(vertexSource) + 1);
+    return hashBytes(fragmentSource, strlen(fragmentSource), hash);
+}
+
+// Binaries are only valid for the driver that produced them, so the
+// vendor, renderer and version strings are part of every key. Core 4.1
+// has the entry points; older contexts need ARB_get_program_binary.
+void detectProgramBinarySupport()
+{
+    if (!programCache.enabled)
+        return;
+    if (!glad_glGetProgramBinary && glfwExtensionSupported("GL_ARB_get_program_binary"))
+    {
+        glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)glfwGetProcAddress("glGetProgramBinary");
+        glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)glfwGetProcAddress("glProgramBinary");
+        glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)glfwGetProcAddress("glProgramParameteri");
+    }
+    int formats = 0;
+    if (glad_glGetProgramBinary && glad_glProgramBinary && glad_glProgramParameteri)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0)
+    {
+        std::cerr << "No program binary support, shaders are compiled every run" << std::endl;
+        programCache.enabled = false;
+        return;
+    }
+
+    std::string driver;
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+    {
+        const GLubyte *value = glGetString(name);
+        driver += value ? reinterpret_cast<const char *>(value) : "";
+        driver += '\n';
+    }
+    programCache.driverHash = hashBytes(driver.data(), driver.size());
+}
+
+std::string programCachePath(uint64_t sourceHash)
+{
+    char name[40];
+    snprintf(name, sizeof(name), "%016llx.progbin",
+             static_cast<unsigned long long>(sourceHash ^ (programCache.driverHash * 31)));
+    return std::string(PROGRAM_CACHE_DIRECTORY) + "/" + name;
+}
+
+// Returns 0 when there is no usable binary; a binary the driver rejects
+// (after a driver update, say) counts as a miss.
+unsigned int loadCachedProgram(uint64_t sourceHash)
 {
-    unsigned int vertexShader = createShader(GL_VERTEX_SHADER, vertexSource);
-    unsigned int fragmentShader = createShader(GL_FRAGMENT_SHADER, fragmentSource);
+    std::ifstream in(programCachePath(sourceHash), std::ios::binary);
+    if (!in)
+        return 0;
+    ProgramCacheHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0 ||
+        header.version != PROGRAM_CACHE_VERSION || header.sourceHash != sourceHash ||
+        header.driverHash != programCache.driverHash)
+        return 0;
+    std::vector<char> binary(header.binarySize);
+    if (!in.read(binary.data(), binary.size()))
+        return 0;
+
     unsigned int program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-    int success;
+    glProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+    int success = 0;
     glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if(!success)
+    if (!success)
     {
-        char infoLog[512];
-        glGetProgramInfoLog(program, 512, NULL, infoLog);
-        std::cerr << "ERROR::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        glDeleteProgram(program);
+        programCache.rejected++;
+        return 0;
     }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
     return program;
 }
 
-unsigned int loadTexture(const char *path)
+void writeCachedProgram(unsigned int program, uint64_t sourceHash)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    ProgramCacheHeader header = {};
+    memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+    header.version = PROGRAM_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.driverHash = programCache.driverHash;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    header.binaryFormat = format;
+    header.binarySize = static_cast<uint32_t>(length);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
+    std::error_code ec;
+    std::filesystem::create_directories(PROGRAM_CACHE_DIRECTORY, ec);
+    std::string cachePath = programCachePath(sourceHash);
+    // Written under a temporary name first, as the mesh and texture caches are.
+    std::string tempPath = cachePath + ".tmp";
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(binary.data(), header.binarySize);
+        if (!out)
+        {
+            std::cerr << "Failed to write program cache: " << cachePath << std::endl;
+            return;
+        }
+    }
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec)
+        std::cerr << "Failed to write program cache: " << cachePath << std::endl;
+}
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// A program whose compile and link have been issued but not yet checked.
+// Programs loaded from the binary cache have no shaders and are ready as
+// soon as they are submitted.
+struct PendingProgram {
+    unsigned int program = 0;
+    unsigned int vertexShader = 0;
+    unsigned int fragmentShader = 0;
+    uint64_t sourceHash = 0;
+    bool fromCache = false;
+};
 
-        stbi_image_free(data);
+PendingProgram submitShaderProgram(const char *vertexSource, const char *fragmentSource)
+{
+    PendingProgram pending;
+    if (programCache.enabled)
+    {
+        pending.sourceHash = hashProgramSources(vertexSource, fragmentSource);
+        pending.program = loadCachedProgram(pending.sourceHash);
+        if (pending.program)
+        {
+            programCache.loaded++;
+            pending.fromCache = true;
+            return pending;
+        }
     }
-    else
+
+    pending.vertexShader = submitShader(GL_VERTEX_SHADER, vertexSource);
+    pending.fragmentShader = submitShader(GL_FRAGMENT_SHADER, fragmentSource);
+    pending.program = glCreateProgram();
+    glAttachShader(pending.program, pending.vertexShader);
+    glAttachShader(pending.program, pending.fragmentShader);
+    if (programCache.enabled)
+        glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(pending.program);
+    return pending;
+}
+
+// Never blocks; without parallel compile support the answer is always yes,
+// and finishing the program is what waits.
+bool shaderProgramReady(const PendingProgram &pending)
+{
+    if (pending.fromCache || !parallelShaderCompile)
+        return true;
+    int done = 0;
+    glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR_VALUE, &done);
+    return done != 0;
+}
+
+unsigned int finishShaderProgram(PendingProgram &pending)
+{
+    if (pending.fromCache)
+        return pending.program;
+    checkShaderCompiled(pending.vertexShader);
+    checkShaderCompiled(pending.fragmentShader);
+    int success;
+    glGetProgramiv(pending.program, GL_LINK_STATUS, &success);
+    if(!success)
     {
-        std::cerr << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        char infoLog[512];
+        glGetProgramInfoLog(pending.program, 512, NULL, infoLog);
+        std::cerr << "ERROR::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
     }
+    glDeleteShader(pending.vertexShader);
+    glDeleteShader(pending.fragmentShader);
+    programCache.compiled++;
+    if (success && programCache.enabled)
+        writeCachedProgram(pending.program, pending.sourceHash);
+    return pending.program;
+}
 
-    return textureID;
+unsigned int createShaderProgram(const char *vertexSource, const char *fragmentSource)
+{
+    PendingProgram pending = submitShaderProgram(vertexSource, fragmentSource);
+    return finishShaderProgram(pending);
 }
 
-Model loadOBJ(const char *path)
+// FNV-1a over a uniform name. It is constexpr so the UNIFORM_* constants
+// below are hashed by the compiler, not on every draw.
+constexpr uint32_t hashUniformName(const char *name, uint32_t hash = 2166136261u)
 {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn, err;
+    return *name ? hashUniformName(name + 1, (hash ^ static_cast<unsigned char>(*name)) * 16777619u) : hash;
+}
 
-    Model model;
-    std::vector<float> vertices;
+const uint32_t UNIFORM_MODEL = hashUniformName("model");
+const uint32_t UNIFORM_MODELS = hashUniformName("models");
+const uint32_t UNIFORM_NORMAL_MATRIX = hashUniformName("normalMatrix");
+const uint32_t UNIFORM_NORMAL_MATRICES = hashUniformName("normalMatrices");
+const uint32_t UNIFORM_POSITION_SCALE = hashUniformName("positionScale");
+const uint32_t UNIFORM_POSITION_OFFSET = hashUniformName("positionOffset");
+const uint32_t UNIFORM_OBJECT_COLOR = hashUniformName("objectColor");
+const uint32_t UNIFORM_TEXTURE1 = hashUniformName("texture1");
+const uint32_t UNIFORM_SHADOW_MAP = hashUniformName("shadowMap");
+const uint32_t UNIFORM_PAGE_TABLE = hashUniformName("pageTable");
+const uint32_t UNIFORM_PHYSICAL_CACHE = hashUniformName("physicalCache");
+const uint32_t UNIFORM_VIRTUAL_SIZE = hashUniformName("virtualSize");
+const uint32_t UNIFORM_VIRTUAL_LEVELS = hashUniformName("virtualLevels");
+const uint32_t UNIFORM_PHYSICAL_CACHE_SIZE = hashUniformName("physicalCacheSize");
+const uint32_t UNIFORM_VIRTUAL_TEXTURE_ID = hashUniformName("virtualTextureId");
+const uint32_t UNIFORM_FEEDBACK_BIAS = hashUniformName("feedbackBias");
+
+struct ShaderUniform {
+    uint32_t nameHash = 0;
+    std::string name;
+    int location = -1;
+    GLenum type = 0;
+    int arraySize = 1;
+    bool sampler = false;
+    // Set once a setter of the wrong type has been reported, so the error
+    // is printed once rather than every frame.
+    mutable bool mismatchReported = false;
+};
+
+// A linked program with its active uniforms, sorted by name hash. Setters
+// find a uniform by binary search over the hashes, so the per-draw path
+// never asks the driver for a location.
+struct ShaderProgram {
+    unsigned int id = 0;
+    std::vector<ShaderUniform> uniforms;
+};
+
+// Counts driver location queries against setter calls; the FPS report shows
+// that the queries stop once the programs have been reflected.
+struct UniformStats {
+    uint64_t locationQueries = 0;
+    uint64_t setterCalls = 0;
+    uint64_t blockUploads = 0;
+    uint64_t reportedQueries = 0;
+    uint64_t reportedSetterCalls = 0;
+    uint64_t reportedBlockUploads = 0;
+};
+
+// Uniform block binding points. Programs are bound to these by block name
+// when they are reflected, so every program sees the same buffers.
+const unsigned int FRAME_UNIFORM_BINDING = 0;
+const unsigned int LIGHT_UNIFORM_BINDING = 1;
+
+int uniformBlockBinding(const char *name)
+{
+    if (strcmp(name, "FrameData") == 0)
+        return FRAME_UNIFORM_BINDING;
+    if (strcmp(name, "LightData") == 0)
+        return LIGHT_UNIFORM_BINDING;
+    return -1;
+}
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path))
+UniformStats uniformStats;
+
+int queryUniformLocation(unsigned int program, const char *name)
+{
+    uniformStats.locationQueries++;
+    return glGetUniformLocation(program, name);
+}
+
+bool isSamplerType(GLenum type)
+{
+    return type == GL_SAMPLER_2D || type == GL_SAMPLER_3D || type == GL_SAMPLER_CUBE ||
+           type == GL_SAMPLER_2D_SHADOW || type == GL_SAMPLER_2D_ARRAY || type == GL_INT_SAMPLER_2D ||
+           type == GL_UNSIGNED_INT_SAMPLER_2D;
+}
+
+// Lists the program's active uniforms once, after linking. Uniforms in
+// blocks have no location and are left out.
+ShaderProgram reflectShaderProgram(unsigned int id)
+{
+    ShaderProgram program;
+    program.id = id;
+    int count = 0, maxLength = 0;
+    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<char> name(std::max(maxLength, 1));
+    for (int i = 0; i < count; i++)
     {
-        std::cerr << "Failed to load OBJ file: " << warn << err << std::endl;
-        return model;
+        ShaderUniform uniform;
+        GLsizei length = 0;
+        glGetActiveUniform(id, i, static_cast<GLsizei>(name.size()), &length, &uniform.arraySize, &uniform.type, name.data());
+        uniform.name.assign(name.data(), length);
+        // Arrays are reported as "name[0]"; setters use the bare name.
+        if (uniform.name.size() > 3 && uniform.name.compare(uniform.name.size() - 3, 3, "[0]") == 0)
+            uniform.name.resize(uniform.name.size() - 3);
+        uniform.location = queryUniformLocation(id, uniform.name.c_str());
+        if (uniform.location < 0)
+            continue;
+        uniform.nameHash = hashUniformName(uniform.name.c_str());
+        uniform.sampler = isSamplerType(uniform.type);
+        program.uniforms.push_back(std::move(uniform));
     }
+    std::sort(program.uniforms.begin(), program.uniforms.end(),
+              [](const ShaderUniform &a, const ShaderUniform &b) { return a.nameHash < b.nameHash; });
 
-    for (const auto &shape : shapes)
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+    name.resize(std::max(maxLength, 1));
+    for (int i = 0; i < count; i++)
     {
-        for (const auto &index : shape.mesh.indices)
-        {
-            vertices.push_back(attrib.vertices[3 * index.vertex_index + 0]);
-            vertices.push_back(attrib.vertices[3 * index.vertex_index + 1]);
-            vertices.push_back(attrib.vertices[3 * index.vertex_index + 2]);
+        glGetActiveUniformBlockName(id, i, static_cast<GLsizei>(name.size()), NULL, name.data());
+        int binding = uniformBlockBinding(name.data());
+        if (binding < 0)
+            std::cerr << "ERROR::PROGRAM::UNKNOWN_UNIFORM_BLOCK " << name.data() << std::endl;
+        else
+            glUniformBlockBinding(id, i, binding);
+    }
+    for (size_t i = 1; i < program.uniforms.size(); i++)
+    {
+        if (program.uniforms[i].nameHash == program.uniforms[i - 1].nameHash)
+            std::cerr << "ERROR::PROGRAM::UNIFORM_HASH_COLLISION " << program.uniforms[i - 1].name << " and "
+                      << program.uniforms[i].name << std::endl;
+    }
+    return program;
+}
 
-            if (index.normal_index >= 0)
-            {
-                vertices.push_back(attrib.normals[3 * index.normal_index + 0]);
-                vertices.push_back(attrib.normals[3 * index.normal_index + 1]);
-                vertices.push_back(attrib.normals[3 * index.normal_index + 2]);
-            }
-            else
-            {
-                vertices.push_back(0.0f);
-                vertices.push_back(0.0f);
-                vertices.push_back(1.0f);
-            }
+ShaderProgram createReflectedProgram(const char *vertexSource, const char *fragmentSource)
+{
+    return reflectShaderProgram(createShaderProgram(vertexSource, fragmentSource));
+}
 
-            if (index.texcoord_index >= 0)
-            {
-                vertices.push_back(attrib.texcoords[2 * index.texcoord_index + 0]);
-                vertices.push_back(attrib.texcoords[2 * index.texcoord_index + 1]);
-            }
-            else
-            {
-                vertices.push_back(0.0f);
-                vertices.push_back(0.0f);
-            }
+// Returns nullptr for names the program does not use, which the setters
+// ignore just as GL ignores location -1.
+const ShaderUniform *findUniform(const ShaderProgram &program, uint32_t nameHash)
+{
+    auto it = std::lower_bound(program.uniforms.begin(), program.uniforms.end(), nameHash,
+                               [](const ShaderUniform &uniform, uint32_t hash) { return uniform.nameHash < hash; });
+    if (it == program.uniforms.end() || it->nameHash != nameHash)
+        return nullptr;
+    return &*it;
+}
 
-            model.indices.push_back(static_cast<unsigned int>(model.indices.size()));
-        }
+const ShaderUniform *findUniformOfType(const ShaderProgram &program, uint32_t nameHash, GLenum type)
+{
+    uniformStats.setterCalls++;
+    const ShaderUniform *uniform = findUniform(program, nameHash);
+    if (!uniform)
+        return nullptr;
+    bool matches = uniform->type == type ||
+                   (type == GL_INT && (uniform->type == GL_BOOL || uniform->sampler));
+    if (!matches)
+    {
+        if (!uniform->mismatchReported)
+            std::cerr << "ERROR::PROGRAM::UNIFORM_TYPE_MISMATCH " << uniform->name << std::endl;
+        uniform->mismatchReported = true;
+        return nullptr;
     }
+    return uniform;
+}
 
-    glGenVertexArrays(1, &model.VAO);
-    glGenBuffers(1, &model.VBO);
-    glGenBuffers(1, &model.EBO);
-
-    glBindVertexArray(model.VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, model.VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, model.indices.size() * sizeof(unsigned int), model.indices.data(), GL_STATIC_DRAW);
+void setUniform(const ShaderProgram &program, uint32_t nameHash, int value)
+{
+    if (const ShaderUniform *uniform = findUniformOfType(program, nameHash, GL_INT))
+        glUniform1i(uniform->location, value);
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+void setUniform(const ShaderProgram &program, uint32_t nameHash, float value)
+{
+    if (const ShaderUniform *uniform = findUniformOfType(program, nameHash, GL_FLOAT))
+        glUniform1f(uniform->location, value);
+}
 
-    glBindVertexArray(0);
+void setUniform(const ShaderProgram &program, uint32_t nameHash, const glm::vec2 &value)
+{
+    if (const ShaderUniform *uniform = findUniformOfType(program, nameHash, GL_FLOAT_VEC2))
+        glUniform2fv(uniform->location, 1, glm::value_ptr(value));
+}
 
-    return model;
+void setUniform(const ShaderProgram &program, uint32_t nameHash, const glm::vec3 &value)
+{
+    if (const ShaderUniform *uniform = findUniformOfType(program, nameHash, GL_FLOAT_VEC3))
+        glUniform3fv(uniform->location, 1, glm::value_ptr(value));
 }
 
-Renderable loadRenderable(const char *objPath, const char *texturePath)
+void setUniform(const ShaderProgram &program, uint32_t nameHash, const glm::mat3 &value)
 {
-    Renderable renderable;
-    renderable.model = loadOBJ(objPath);
-    renderable.texture = loadTexture(texturePath);
-    return renderable;
+    if (const ShaderUniform *uniform = findUniformOfType(program, nameHash, GL_FLOAT_MAT3))
+        glUniformMatrix3fv(uniform->location, 1, GL_FALSE, glm::value_ptr(value));
 }
 
-void renderObj(unsigned int shaderProgram, const Renderable &renderable,
-               glm::vec3 position, glm::vec3 rotation, glm::vec3 size)
+void setUniform(const ShaderProgram &program, uint32_t nameHash, const glm::mat4 &value)
 {
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
-    model = glm::rotate(model, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::scale(model, size);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    if (const ShaderUniform *uniform = findUniformOfType(program, nameHash, GL_FLOAT_MAT4))
+        glUniformMatrix4fv(uniform->location, 1, GL_FALSE, glm::value_ptr(value));
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, renderable.texture);
+// Array setters write the first count elements, clamped to the declared size.
+void setUniformArray(const ShaderProgram &program, uint32_t nameHash, const glm::mat3 *values, int count)
+{
+    if (const ShaderUniform *uniform = findUniformOfType(program, nameHash, GL_FLOAT_MAT3))
+        glUniformMatrix3fv(uniform->location, std::min(count, uniform->arraySize), GL_FALSE, glm::value_ptr(values[0]));
+}
 
-    glBindVertexArray(renderable.model.VAO);
-    glDrawElements(GL_TRIANGLES, renderable.model.indices.size(), GL_UNSIGNED_INT, 0);
+void setUniformArray(const ShaderProgram &program, uint32_t nameHash, const glm::mat4 *values, int count)
+{
+    if (const ShaderUniform *uniform = findUniformOfType(program, nameHash, GL_FLOAT_MAT4))
+        glUniformMatrix4fv(uniform->location, std::min(count, uniform->arraySize), GL_FALSE, glm::value_ptr(values[0]));
 }
 
-void renderObjDepth(unsigned int shaderProgram, const Renderable &renderable,
-                    glm::vec3 position, glm::vec3 rotation, glm::vec3 size)
+// Only the program last bound through here is tracked, so every glUseProgram
+// in the render loop should go through it.
+unsigned int currentShaderProgram = 0;
+
+void useShaderProgram(const ShaderProgram &program)
 {
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
-    model = glm::rotate(model, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::scale(model, size);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    if (program.id == currentShaderProgram)
+        return;
+    glUseProgram(program.id);
+    currentShaderProgram = program.id;
+}
+
+// Feature bits of a scene shader variant. Each set bit becomes a #define in
+// front of the shader body, so a variant carries only the work its draws need.
+const uint32_t SHADER_SHADOWS = 1u << 0;
+const uint32_t SHADER_TEXTURE = 1u << 1;
+const uint32_t SHADER_VIRTUAL_TEXTURE = 1u << 2;
+const uint32_t SHADER_UNIFORM_SCALE = 1u << 3;
+const uint32_t SHADER_INSTANCED = 1u << 4;
+
+// Model matrices per instanced draw; larger batches are split.
+const int MAX_SHADER_INSTANCES = 64;
+
+struct ShaderFeatureDefine {
+    uint32_t feature;
+    const char *name;
+};
+
+const ShaderFeatureDefine SHADER_FEATURE_DEFINES[] = {
+    {SHADER_SHADOWS, "SHADOWS"},
+    {SHADER_TEXTURE, "TEXTURE"},
+    {SHADER_VIRTUAL_TEXTURE, "VIRTUAL_TEXTURE"},
+    {SHADER_UNIFORM_SCALE, "UNIFORM_SCALE"},
+    {SHADER_INSTANCED, "INSTANCED"},
+};
 
-    glBindVertexArray(renderable.model.VAO);
-    glDrawElements(GL_TRIANGLES, renderable.model.indices.size(), GL_UNSIGNED_INT, 0);
+std::string buildShaderSource(const char *body, uint32_t features)
+{
+    std::string source = "#version 330 core\n";
+    for (const ShaderFeatureDefine &define : SHADER_FEATURE_DEFINES)
+    {
+        if (features & define.feature)
+            source += std::string("#define ") + define.name + "\n";
+    }
+    if (features & SHADER_INSTANCED)
+        source += "#define MAX_INSTANCES " + std::to_string(MAX_SHADER_INSTANCES) + "\n";
+    return source + body;
 }
 
-int main()
+std::string shaderFeatureNames(uint32_t features)
 {
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    
-    GLFWwindow* window = glfwCreateWindow(800, 600, "Rendering Test", NULL, NULL);
-    if (!window)
+    std::string names;
+    for (const ShaderFeatureDefine &define : SHADER_FEATURE_DEFINES)
     {
-        std::cerr << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+        if (features & define.feature)
+            names += (names.empty() ? "" : "+") + std::string(define.name);
     }
-    glfwMakeContextCurrent(window);
-    
+    return names.empty() ? "BASE" : names;
+}
+
+// tools/optimize_shaders.sh runs the stages --export-shaders writes through
+// glslang, spirv-opt and SPIRV-Cross, and generates optimized_shaders.h from
+// the GLSL 330 that comes back. With --optimized-shaders, stages found there
+// replace the embedded text; until the generated header has been checked
+// against the embedded shaders on the target drivers it stays opt-in.
+bool useOptimizedShaders = false;
+
+// Stage names look like "scene.SHADOWS+TEXTURE.frag".
+std::string shaderStageName(const char *family, uint32_t features, const char *stage)
+{
+    return std::string(family) + "." + shaderFeatureNames(features) + "." + stage;
+}
+
+#ifdef HAVE_OPTIMIZED_SHADERS
+const char *findOptimizedShader(const std::string &name)
+{
+    if (useOptimizedShaders)
+    {
+        for (const OptimizedShader &shader : OPTIMIZED_SHADERS)
+        {
+            if (name == shader.name)
+                return shader.source;
+        }
+    }
+    return nullptr;
+}
+#else
+const char *findOptimizedShader(const std::string &)
+{
+    return nullptr;
+}
+#endif
+
+std::string shaderStageSource(const char *family, const char *body, uint32_t features, const char *stage)
+{
+    if (const char *optimized = findOptimizedShader(shaderStageName(family, features, stage)))
+        return optimized;
+    return buildShaderSource(body, features);
+}
+
+// Linked variants of one vertex/fragment pair, keyed by feature bits.
+// Variants are submitted without waiting and finished by
+// pollShaderVariants once the driver reports them done (or, without
+// parallel compile support, a frame after submission, so a batch of
+// submits is checked together). initialize runs once per finished
+// variant, with the program bound, to set its constant uniforms.
+struct PendingVariant {
+    PendingProgram program;
+    uint64_t submittedFrame = 0;
+    std::chrono::steady_clock::time_point submitted;
+};
+
+struct ShaderVariantCache {
+    const char *name = nullptr;
+    const char *vertexSource = nullptr;
+    const char *fragmentSource = nullptr;
+    void (*initialize)(const ShaderProgram &program) = nullptr;
+    std::unordered_map<uint32_t, ShaderProgram> programs;
+    std::unordered_map<uint32_t, PendingVariant> pending;
+    uint64_t frame = 0;
+};
+
+// Set with --sync-shader-compile to wait for each variant on first use.
+bool asyncShaderCompile = true;
+
+const ShaderProgram &finishShaderVariant(ShaderVariantCache &cache, uint32_t features);
+
+// Submits a variant unless it is linked or in flight. Binaries from the
+// program cache have nothing to wait for and are finished right away.
+void requestShaderVariant(ShaderVariantCache &cache, uint32_t features)
+{
+    if (cache.programs.count(features) || cache.pending.count(features))
+        return;
+    std::string vertexSource = shaderStageSource(cache.name, cache.vertexSource, features, "vert");
+    std::string fragmentSource = shaderStageSource(cache.name, cache.fragmentSource, features, "frag");
+    PendingVariant variant;
+    variant.submitted = std::chrono::steady_clock::now();
+    variant.program = submitShaderProgram(vertexSource.c_str(), fragmentSource.c_str());
+    variant.submittedFrame = cache.frame;
+    cache.pending.emplace(features, variant);
+    if (variant.program.fromCache)
+        finishShaderVariant(cache, features);
+}
+
+const ShaderProgram &finishShaderVariant(ShaderVariantCache &cache, uint32_t features)
+{
+    auto it = cache.pending.find(features);
+    PendingVariant variant = it->second;
+    cache.pending.erase(it);
+    ShaderProgram program = reflectShaderProgram(finishShaderProgram(variant.program));
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - variant.submitted).count();
+    if (variant.program.fromCache)
+        std::cout << "Loaded cached shader variant " << shaderFeatureNames(features) << " in " << elapsed << " ms" << std::endl;
+    else
+        std::cout << "Compiled shader variant " << shaderFeatureNames(features) << ", ready " << elapsed
+                  << " ms after submission" << std::endl;
+
+    const ShaderProgram &cached = cache.programs.emplace(features, std::move(program)).first->second;
+    if (cache.initialize)
+    {
+        useShaderProgram(cached);
+        cache.initialize(cached);
+    }
+    return cached;
+}
+
+// Returns the variant if it is linked, otherwise submits it (once) and
+// returns nullptr so the caller can draw with a fallback.
+const ShaderProgram *findShaderVariant(ShaderVariantCache &cache, uint32_t features)
+{
+    auto it = cache.programs.find(features);
+    if (it != cache.programs.end())
+        return &it->second;
+    requestShaderVariant(cache, features);
+    it = cache.programs.find(features);
+    if (it != cache.programs.end())
+        return &it->second;
+    if (!asyncShaderCompile)
+        return &finishShaderVariant(cache, features);
+    return nullptr;
+}
+
+// Blocks until the variant is linked; for fallbacks, which must exist.
+const ShaderProgram &getShaderVariant(ShaderVariantCache &cache, uint32_t features)
+{
+    if (const ShaderProgram *program = findShaderVariant(cache, features))
+        return *program;
+    return finishShaderVariant(cache, features);
+}
+
+// Once per frame: finishes the variants that are ready.
+void pollShaderVariants(ShaderVariantCache &cache)
+{
+    cache.frame++;
+    std::vector<uint32_t> ready;
+    for (const auto &entry : cache.pending)
+    {
+        bool done = parallelShaderCompile ? shaderProgramReady(entry.second.program)
+                                          : entry.second.submittedFrame < cache.frame;
+        if (done)
+            ready.push_back(entry.first);
+    }
+    for (uint32_t features : ready)
+        finishShaderVariant(cache, features);
+}
+
+void destroyShaderVariants(ShaderVariantCache &cache)
+{
+    for (auto &entry : cache.pending)
+    {
+        const PendingProgram &pending = entry.second.program;
+        if (!pending.fromCache)
+        {
+            glDeleteShader(pending.vertexShader);
+            glDeleteShader(pending.fragmentShader);
+        }
+        glDeleteProgram(pending.program);
+    }
+    for (auto &entry : cache.programs)
+        glDeleteProgram(entry.second.id);
+    cache.pending.clear();
+    cache.programs.clear();
+}
+
+// CPU copies of the std140 blocks. vec3 members take a vec4 slot, since
+// std140 aligns them to 16 bytes.
+struct FrameUniforms {
+    glm::mat4 view = glm::mat4(1.0f);
+    glm::mat4 projection = glm::mat4(1.0f);
+    glm::vec4 viewPos = glm::vec4(0.0f);
+};
+
+struct LightUniforms {
+    glm::mat4 lightSpaceMatrix = glm::mat4(1.0f);
+    glm::vec4 lightPos = glm::vec4(0.0f);
+    glm::vec4 lightColor = glm::vec4(1.0f);
+};
+
+static_assert(sizeof(FrameUniforms) == 144, "FrameUniforms must match the std140 FrameData block");
+static_assert(sizeof(LightUniforms) == 96, "LightUniforms must match the std140 LightData block");
+
+struct UniformBlock {
+    unsigned int buffer = 0;
+    bool dirty = true;
+};
+
+// The frame and light blocks. Setters only mark a block dirty when its
+// contents change, and flushSceneUniforms uploads the dirty ones, so a
+// static camera or light costs nothing per frame.
+struct SceneUniforms {
+    FrameUniforms frame;
+    LightUniforms light;
+    UniformBlock frameBlock;
+    UniformBlock lightBlock;
+};
+
+SceneUniforms sceneUniforms;
+
+void createUniformBlock(UniformBlock &block, unsigned int binding, size_t size)
+{
+    glGenBuffers(1, &block.buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, block.buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, block.buffer);
+    block.dirty = true;
+}
+
+void createSceneUniforms()
+{
+    createUniformBlock(sceneUniforms.frameBlock, FRAME_UNIFORM_BINDING, sizeof(FrameUniforms));
+    createUniformBlock(sceneUniforms.lightBlock, LIGHT_UNIFORM_BINDING, sizeof(LightUniforms));
+}
+
+void destroySceneUniforms()
+{
+    glDeleteBuffers(1, &sceneUniforms.frameBlock.buffer);
+    glDeleteBuffers(1, &sceneUniforms.lightBlock.buffer);
+    sceneUniforms = SceneUniforms();
+}
+
+template <typename T>
+void updateUniformValue(T &stored, const T &value, UniformBlock &block)
+{
+    if (memcmp(&stored, &value, sizeof(T)) != 0)
+    {
+        stored = value;
+        block.dirty = true;
+    }
+}
+
+void setFrameUniforms(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &viewPos)
+{
+    FrameUniforms frame;
+    frame.view = view;
+    frame.projection = projection;
+    frame.viewPos = glm::vec4(viewPos, 1.0f);
+    updateUniformValue(sceneUniforms.frame, frame, sceneUniforms.frameBlock);
+}
+
+void setLightUniforms(const glm::mat4 &lightSpaceMatrix, const glm::vec3 &lightPos, const glm::vec3 &lightColor)
+{
+    LightUniforms light;
+    light.lightSpaceMatrix = lightSpaceMatrix;
+    light.lightPos = glm::vec4(lightPos, 1.0f);
+    light.lightColor = glm::vec4(lightColor, 1.0f);
+    updateUniformValue(sceneUniforms.light, light, sceneUniforms.lightBlock);
+}
+
+void flushUniformBlock(UniformBlock &block, const void *data, size_t size)
+{
+    if (!block.dirty)
+        return;
+    glBindBuffer(GL_UNIFORM_BUFFER, block.buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    block.dirty = false;
+    uniformStats.blockUploads++;
+}
+
+void flushSceneUniforms()
+{
+    flushUniformBlock(sceneUniforms.frameBlock, &sceneUniforms.frame, sizeof(FrameUniforms));
+    flushUniformBlock(sceneUniforms.lightBlock, &sceneUniforms.light, sizeof(LightUniforms));
+}
+
+void reportUniformStats()
+{
+    std::cout << "Uniforms: " << uniformStats.setterCalls - uniformStats.reportedSetterCalls << " sets, "
+              << uniformStats.blockUploads - uniformStats.reportedBlockUploads << " block uploads, "
+              << uniformStats.locationQueries - uniformStats.reportedQueries << " location queries ("
+              << uniformStats.locationQueries << " since start)" << std::endl;
+    uniformStats.reportedSetterCalls = uniformStats.setterCalls;
+    uniformStats.reportedBlockUploads = uniformStats.blockUploads;
+    uniformStats.reportedQueries = uniformStats.locationQueries;
+}
+
+struct VertexKey {
+    int vertexIndex, normalIndex, texcoordIndex;
+
+    bool operator==(const VertexKey &other) const
+    {
+        return vertexIndex == other.vertexIndex &&
+               normalIndex == other.normalIndex &&
+               texcoordIndex == other.texcoordIndex;
+    }
+};
+
+struct VertexKeyHash {
+    size_t operator()(const VertexKey &key) const
+    {
+        size_t h = static_cast<size_t>(key.vertexIndex) * 73856093u;
+        h ^= static_cast<size_t>(key.normalIndex) * 19349663u;
+        h ^= static_cast<size_t>(key.texcoordIndex) * 83492791u;
+        return h;
+    }
+};
+
+void computeBounds(MeshData &mesh)
+{
+    if (mesh.vertices.empty())
+        return;
+
+    mesh.boundsMin = glm::vec3(mesh.vertices[0], mesh.vertices[1], mesh.vertices[2]);
+    mesh.boundsMax = mesh.boundsMin;
+    for (size_t i = 0; i < mesh.vertices.size(); i += VERTEX_STRIDE)
+    {
+        glm::vec3 position(mesh.vertices[i + 0], mesh.vertices[i + 1], mesh.vertices[i + 2]);
+        mesh.boundsMin = glm::min(mesh.boundsMin, position);
+        mesh.boundsMax = glm::max(mesh.boundsMax, position);
+    }
+}
+
+// Welds face corners that share the same (position, normal, texcoord) triple
+// into a single vertex, so the index buffer actually gets reused.
+MeshData buildMeshData(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::shape_t> &shapes)
+{
+    MeshData mesh;
+
+    size_t cornerCount = 0;
+    for (const auto &shape : shapes)
+        cornerCount += shape.mesh.indices.size();
+
+    std::unordered_map<VertexKey, unsigned int, VertexKeyHash> uniqueVertices;
+    uniqueVertices.reserve(cornerCount);
+    mesh.indices.reserve(cornerCount);
+
+    for (const auto &shape : shapes)
+    {
+        for (const auto &index : shape.mesh.indices)
+        {
+            VertexKey key = {index.vertex_index, index.normal_index, index.texcoord_index};
+            auto found = uniqueVertices.find(key);
+            if (found != uniqueVertices.end())
+            {
+                mesh.indices.push_back(found->second);
+                continue;
+            }
+
+            unsigned int newIndex = static_cast<unsigned int>(mesh.vertices.size() / VERTEX_STRIDE);
+            uniqueVertices.emplace(key, newIndex);
+            mesh.indices.push_back(newIndex);
+
+            mesh.vertices.push_back(attrib.vertices[3 * index.vertex_index + 0]);
+            mesh.vertices.push_back(attrib.vertices[3 * index.vertex_index + 1]);
+            mesh.vertices.push_back(attrib.vertices[3 * index.vertex_index + 2]);
+
+            if (index.normal_index >= 0)
+            {
+                mesh.vertices.push_back(attrib.normals[3 * index.normal_index + 0]);
+                mesh.vertices.push_back(attrib.normals[3 * index.normal_index + 1]);
+                mesh.vertices.push_back(attrib.normals[3 * index.normal_index + 2]);
+            }
+            else
+            {
+                mesh.vertices.push_back(0.0f);
+                mesh.vertices.push_back(0.0f);
+                mesh.vertices.push_back(1.0f);
+            }
+
+            if (index.texcoord_index >= 0)
+            {
+                mesh.vertices.push_back(attrib.texcoords[2 * index.texcoord_index + 0]);
+                mesh.vertices.push_back(attrib.texcoords[2 * index.texcoord_index + 1]);
+            }
+            else
+            {
+                mesh.vertices.push_back(0.0f);
+                mesh.vertices.push_back(0.0f);
+            }
+        }
+    }
+
+    computeBounds(mesh);
+    return mesh;
+}
+
+size_t positionSize(PositionEncoding encoding)
+{
+    return encoding == PositionEncoding::Float32 ? 3 * sizeof(float) : 4 * sizeof(uint16_t);
+}
+
+size_t normalSize(NormalEncoding encoding)
+{
+    return encoding == NormalEncoding::Float32 ? 3 * sizeof(float) : sizeof(uint32_t);
+}
+
+size_t texcoordSize(TexcoordEncoding encoding)
+{
+    return encoding == TexcoordEncoding::Float32 ? 2 * sizeof(float) : 2 * sizeof(uint16_t);
+}
+
+// Re-encodes interleaved float vertices into `layout`. Positions are
+// normalized against [boundsMin, boundsMax]; the matching scale and offset
+// are stored on the model for the vertex shader.
+std::vector<unsigned char> encodeVertices(const float *vertices, size_t vertexCount, const VertexLayout &layout,
+                                          glm::vec3 boundsMin, glm::vec3 boundsMax, Model &model)
+{
+    size_t normalOffset = positionSize(layout.position);
+    size_t texcoordOffset = normalOffset + normalSize(layout.normal);
+    size_t stride = texcoordOffset + texcoordSize(layout.texcoord);
+
+    glm::vec3 extent = boundsMax - boundsMin;
+    glm::vec3 invExtent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                        extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                        extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+    if (layout.position == PositionEncoding::Unorm16)
+    {
+        model.positionScale = extent;
+        model.positionOffset = boundsMin;
+    }
+
+    std::vector<unsigned char> encoded(vertexCount * stride);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        const float *source = vertices + v * VERTEX_STRIDE;
+        unsigned char *target = encoded.data() + v * stride;
+
+        if (layout.position == PositionEncoding::Float32)
+        {
+            memcpy(target, source, 3 * sizeof(float));
+        }
+        else
+        {
+            glm::vec3 normalized = glm::clamp((glm::make_vec3(source) - boundsMin) * invExtent, 0.0f, 1.0f);
+            uint16_t packed[4] = {static_cast<uint16_t>(std::lround(normalized.x * 65535.0f)),
+                                  static_cast<uint16_t>(std::lround(normalized.y * 65535.0f)),
+                                  static_cast<uint16_t>(std::lround(normalized.z * 65535.0f)), 0};
+            memcpy(target, packed, sizeof(packed));
+        }
+
+        if (layout.normal == NormalEncoding::Float32)
+        {
+            memcpy(target + normalOffset, source + 3, 3 * sizeof(float));
+        }
+        else
+        {
+            glm::vec3 normal = glm::make_vec3(source + 3);
+            float length = glm::length(normal);
+            if (length > 0.0f)
+                normal /= length;
+            uint32_t packed = glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f));
+            memcpy(target + normalOffset, &packed, sizeof(packed));
+        }
+
+        if (layout.texcoord == TexcoordEncoding::Float32)
+        {
+            memcpy(target + texcoordOffset, source + 6, 2 * sizeof(float));
+        }
+        else
+        {
+            uint32_t packed = glm::packHalf2x16(glm::make_vec2(source + 6));
+            memcpy(target + texcoordOffset, &packed, sizeof(packed));
+        }
+    }
+    return encoded;
+}
+
+size_t vertexLayoutStride(const VertexLayout &layout)
+{
+    return positionSize(layout.position) + normalSize(layout.normal) + texcoordSize(layout.texcoord);
+}
+
+// Identifies a layout in a .meshcache header.
+uint32_t vertexLayoutId(const VertexLayout &layout)
+{
+    return static_cast<uint32_t>(layout.position) | static_cast<uint32_t>(layout.normal) << 4 |
+           static_cast<uint32_t>(layout.texcoord) << 8;
+}
+
+// Points attributes 0-2 of the bound VAO at the bound GL_ARRAY_BUFFER.
+void setVertexAttributes(const VertexLayout &layout)
+{
+    size_t normalOffset = positionSize(layout.position);
+    size_t texcoordOffset = normalOffset + normalSize(layout.normal);
+    GLsizei stride = static_cast<GLsizei>(vertexLayoutStride(layout));
+
+    if (layout.position == PositionEncoding::Float32)
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    else
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+    glEnableVertexAttribArray(0);
+
+    if (layout.normal == NormalEncoding::Float32)
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)normalOffset);
+    else
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)normalOffset);
+    glEnableVertexAttribArray(1);
+
+    if (layout.texcoord == TexcoordEncoding::Float32)
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)texcoordOffset);
+    else
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)texcoordOffset);
+    glEnableVertexAttribArray(2);
+}
+
+// Creates the GL objects for vertex bytes in vertexLayout and indices of
+// model.indexType. model carries everything but the GL object names.
+Model uploadMesh(Model model, const void *vertices, size_t vertexSize, const void *indices, size_t indexSize)
+{
+    glGenVertexArrays(1, &model.VAO);
+    glGenBuffers(1, &model.VBO);
+    glGenBuffers(1, &model.EBO);
+
+    glBindVertexArray(model.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, model.VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertexSize, vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize, indices, GL_STATIC_DRAW);
+    setVertexAttributes(vertexLayout);
+    glBindVertexArray(0);
+    return model;
+}
+
+// A mesh converted to the bytes uploadMesh sends, which are also what a
+// .meshcache stores, so it can be built off the GL thread and uploaded
+// piecewise. model carries everything but the GL object names.
+struct PreparedMesh {
+    Model model;
+    std::vector<unsigned char> vertexBytes;
+    std::vector<unsigned char> indexBytes;
+};
+
+PreparedMesh prepareMesh(const MeshData &mesh)
+{
+    PreparedMesh prepared;
+    size_t vertexCount = mesh.vertices.size() / VERTEX_STRIDE;
+    prepared.model.indexCount = static_cast<unsigned int>(mesh.indices.size());
+    prepared.model.boundsMin = mesh.boundsMin;
+    prepared.model.boundsMax = mesh.boundsMax;
+
+    if (vertexLayoutStride(vertexLayout) == VERTEX_STRIDE * sizeof(float))
+    {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(mesh.vertices.data());
+        prepared.vertexBytes.assign(bytes, bytes + mesh.vertices.size() * sizeof(float));
+    }
+    else
+    {
+        prepared.vertexBytes = encodeVertices(mesh.vertices.data(), vertexCount, vertexLayout,
+                                              mesh.boundsMin, mesh.boundsMax, prepared.model);
+    }
+
+    if (vertexCount <= 65536)
+    {
+        prepared.model.indexType = GL_UNSIGNED_SHORT;
+        prepared.indexBytes.resize(mesh.indices.size() * sizeof(uint16_t));
+        uint16_t *shortIndices = reinterpret_cast<uint16_t *>(prepared.indexBytes.data());
+        for (size_t i = 0; i < mesh.indices.size(); i++)
+            shortIndices[i] = static_cast<uint16_t>(mesh.indices[i]);
+    }
+    else
+    {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(mesh.indices.data());
+        prepared.indexBytes.assign(bytes, bytes + mesh.indices.size() * sizeof(unsigned int));
+    }
+    return prepared;
+}
+
+Model uploadMesh(const MeshData &mesh)
+{
+    PreparedMesh prepared = prepareMesh(mesh);
+    return uploadMesh(prepared.model, prepared.vertexBytes.data(), prepared.vertexBytes.size(),
+                      prepared.indexBytes.data(), prepared.indexBytes.size());
+}
+
+bool mapFile(const char *path, MappedFile &mapped)
+{
+#ifdef _WIN32
+    mapped.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (mapped.file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(mapped.file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(mapped.file);
+        mapped.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    mapped.size = static_cast<size_t>(fileSize.QuadPart);
+
+    mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapped.mapping)
+        mapped.data = static_cast<const unsigned char *>(MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!mapped.data)
+    {
+        if (mapped.mapping)
+            CloseHandle(mapped.mapping);
+        CloseHandle(mapped.file);
+        mapped = MappedFile();
+        return false;
+    }
+#else
+    mapped.fd = open(path, O_RDONLY);
+    if (mapped.fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(mapped.fd, &info) != 0 || info.st_size == 0)
+    {
+        close(mapped.fd);
+        mapped.fd = -1;
+        return false;
+    }
+    mapped.size = static_cast<size_t>(info.st_size);
+
+    void *data = mmap(NULL, mapped.size, PROT_READ, MAP_PRIVATE, mapped.fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(mapped.fd);
+        mapped = MappedFile();
+        return false;
+    }
+    mapped.data = static_cast<const unsigned char *>(data);
+#endif
+    return true;
+}
+
+void unmapFile(MappedFile &mapped)
+{
+    if (!mapped.data)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapped.data);
+    CloseHandle(mapped.mapping);
+    CloseHandle(mapped.file);
+#else
+    munmap(const_cast<unsigned char *>(mapped.data), mapped.size);
+    close(mapped.fd);
+#endif
+    mapped = MappedFile();
+}
+
+bool getSourceStamp(const char *path, uint64_t &size, int64_t &modified)
+{
+    std::error_code ec;
+    size = std::filesystem::file_size(path, ec);
+    if (ec)
+        return false;
+    auto writeTime = std::filesystem::last_write_time(path, ec);
+    if (ec)
+        return false;
+    modified = static_cast<int64_t>(writeTime.time_since_epoch().count());
+    return true;
+}
+
+size_t meshIndexSize(uint32_t indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+}
+
+// 64-bit FNV-1a of the whole file.
+bool hashFileContents(const char *path, uint64_t &hash, uint64_t &size)
+{
+    MappedFile mapped;
+    if (!mapFile(path, mapped))
+        return false;
+    hash = hashBytes(mapped.data, mapped.size);
+    size = mapped.size;
+    unmapFile(mapped);
+    return true;
+}
+
+// Reads the content hash a cache header recorded for its source, if the
+// cache was written for the source as it is now. Only the stamp has to
+// match: the hash describes the source, whatever the cache's settings.
+template <typename Header>
+bool readCachedContentHash(const std::string &cachePath, const char *sourcePath, const char (&magic)[4],
+                           uint32_t version, uint64_t &hash, uint64_t &size)
+{
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    if (!getSourceStamp(sourcePath, sourceSize, sourceModified))
+        return false;
+    MappedFile mapped;
+    if (!mapFile(cachePath.c_str(), mapped))
+        return false;
+    const Header *header = reinterpret_cast<const Header *>(mapped.data);
+    bool valid = mapped.size >= sizeof(Header) &&
+                 memcmp(header->magic, magic, sizeof(magic)) == 0 &&
+                 header->version == version &&
+                 header->sourceSize == sourceSize &&
+                 header->sourceModified == sourceModified;
+    if (valid)
+    {
+        hash = header->contentHash;
+        size = sourceSize;
+    }
+    unmapFile(mapped);
+    return valid;
+}
+
+// Maps a .meshcache and validates it against the source OBJ. On success the
+// returned header points into the mapping, which the caller must unmap.
+const MeshCacheHeader *openMeshCache(const std::string &cachePath, const char *sourcePath, uint32_t flags,
+                                     MappedFile &mapped)
+{
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    if (!getSourceStamp(sourcePath, sourceSize, sourceModified))
+        return nullptr;
+    if (!mapFile(cachePath.c_str(), mapped))
+        return nullptr;
+
+    const MeshCacheHeader *header = reinterpret_cast<const MeshCacheHeader *>(mapped.data);
+    bool valid = mapped.size >= sizeof(MeshCacheHeader) &&
+                 memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) == 0 &&
+                 header->version == MESH_CACHE_VERSION &&
+                 header->vertexLayout == vertexLayoutId(vertexLayout) &&
+                 header->vertexStride == vertexLayoutStride(vertexLayout) &&
+                 (header->indexType == GL_UNSIGNED_SHORT || header->indexType == GL_UNSIGNED_INT) &&
+                 header->flags == flags &&
+                 header->sourceSize == sourceSize &&
+                 header->sourceModified == sourceModified &&
+                 mapped.size == sizeof(MeshCacheHeader) +
+                                 static_cast<size_t>(header->vertexCount) * header->vertexStride +
+                                 static_cast<size_t>(header->indexCount) * meshIndexSize(header->indexType);
+    if (!valid)
+    {
+        unmapFile(mapped);
+        return nullptr;
+    }
+    return header;
+}
+
+void writeMeshCache(const std::string &cachePath, const char *sourcePath, uint32_t flags, const PreparedMesh &mesh)
+{
+    MeshCacheHeader header = {};
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    if (!getSourceStamp(sourcePath, header.sourceSize, header.sourceModified))
+        return;
+    uint64_t sourceSize;
+    if (!hashFileContents(sourcePath, header.contentHash, sourceSize))
+        return;
+    header.vertexLayout = vertexLayoutId(vertexLayout);
+    header.vertexStride = static_cast<uint32_t>(vertexLayoutStride(vertexLayout));
+    header.flags = flags;
+    header.vertexCount = static_cast<uint32_t>(mesh.vertexBytes.size() / header.vertexStride);
+    header.indexCount = mesh.model.indexCount;
+    header.indexType = mesh.model.indexType;
+    for (int i = 0; i < 3; i++)
+    {
+        header.boundsMin[i] = mesh.model.boundsMin[i];
+        header.boundsMax[i] = mesh.model.boundsMax[i];
+        header.positionScale[i] = mesh.model.positionScale[i];
+        header.positionOffset[i] = mesh.model.positionOffset[i];
+    }
+
+    // Write to a temporary name first so a crash never leaves a truncated cache behind.
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cerr << "Failed to write mesh cache: " << cachePath << std::endl;
+            return;
+        }
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(mesh.vertexBytes.data()), mesh.vertexBytes.size());
+        out.write(reinterpret_cast<const char *>(mesh.indexBytes.data()), mesh.indexBytes.size());
+        if (!out)
+        {
+            std::cerr << "Failed to write mesh cache: " << cachePath << std::endl;
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec)
+        std::cerr << "Failed to write mesh cache: " << cachePath << std::endl;
+}
+
+// A face corner from the first parallel pass. Positive OBJ indices are final
+// as soon as they are read; negative (relative) ones are stored relative to
+// the start of their chunk and fixed up once the chunk's base offset is known.
+struct ObjChunkCorner {
+    int v, vt, vn;
+    unsigned char relative;
+};
+
+const unsigned char OBJ_RELATIVE_V = 1;
+const unsigned char OBJ_RELATIVE_VT = 2;
+const unsigned char OBJ_RELATIVE_VN = 4;
+
+// Smoothing ids on faces that appear before the chunk's first 's' line
+// depend on the previous chunk and are resolved during the merge.
+const unsigned int OBJ_INHERIT_SMOOTHING = 0xffffffffu;
+
+struct ObjShapeBreak {
+    size_t faceIndex;
+    std::string name;
+};
+
+struct ObjChunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    bool supported = true;
+
+    std::vector<tinyobj::real_t> vertices, vertexWeights, colors, normals, texcoords;
+    std::vector<ObjChunkCorner> corners;
+    std::vector<unsigned int> faceSizes;
+    std::vector<unsigned int> smoothingIds;
+    std::vector<ObjShapeBreak> breaks;
+    unsigned int lastSmoothingId = OBJ_INHERIT_SMOOTHING;
+
+    size_t vertexBase = 0, normalBase = 0, texcoordBase = 0;
+    std::vector<tinyobj::mesh_t> segments;
+};
+
+// Mirrors tinyobj::parseRawTriple, but keeps "absent" distinct from an
+// explicit zero so the chunk can bail out where LoadObj would warn.
+bool parseObjCorner(const char **token, ObjChunk &chunk, ObjChunkCorner &corner)
+{
+    corner.v = corner.vt = corner.vn = -1;
+    corner.relative = 0;
+
+    int *fields[3] = {&corner.v, &corner.vt, &corner.vn};
+    const unsigned char relativeBits[3] = {OBJ_RELATIVE_V, OBJ_RELATIVE_VT, OBJ_RELATIVE_VN};
+    const size_t localCounts[3] = {chunk.vertices.size() / 3, chunk.texcoords.size() / 2, chunk.normals.size() / 3};
+
+    for (int field = 0; field < 3; field++)
+    {
+        if (field > 0)
+        {
+            if ((*token)[0] != '/')
+                break;
+            (*token)++;
+            // i//k skips the texcoord field.
+            if (field == 1 && (*token)[0] == '/')
+                continue;
+        }
+
+        int raw = atoi(*token);
+        (*token) += strcspn(*token, "/ \t\r");
+        if (raw == 0)
+            return false;
+        if (raw > 0)
+        {
+            *fields[field] = raw - 1;
+        }
+        else
+        {
+            *fields[field] = static_cast<int>(localCounts[field]) + raw;
+            corner.relative |= relativeBits[field];
+        }
+    }
+    return true;
+}
+
+// First pass: parse one chunk of whole lines. Anything outside the
+// v/vn/vt/f/g/o/s subset marks the chunk unsupported, and the caller falls
+// back to tinyobj::LoadObj so the result never differs from the serial path.
+void parseObjChunk(ObjChunk &chunk)
+{
+    std::string line;
+    unsigned int smoothingId = OBJ_INHERIT_SMOOTHING;
+
+    const char *cursor = chunk.begin;
+    while (cursor < chunk.end && chunk.supported)
+    {
+        const char *lineEnd = static_cast<const char *>(memchr(cursor, '\n', chunk.end - cursor));
+        if (!lineEnd)
+            lineEnd = chunk.end;
+        line.assign(cursor, lineEnd);
+        cursor = lineEnd + 1;
+
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.find('\r') != std::string::npos || line.find('\0') != std::string::npos)
+        {
+            chunk.supported = false;
+            break;
+        }
+
+        const char *token = line.c_str();
+        token += strspn(token, " \t");
+        if (token[0] == '\0' || token[0] == '#')
+            continue;
+
+        if (token[0] == 'v' && IS_SPACE(token[1]))
+        {
+            token += 2;
+            tinyobj::real_t x, y, z, r, g, b;
+            tinyobj::parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+            chunk.vertices.push_back(x);
+            chunk.vertices.push_back(y);
+            chunk.vertices.push_back(z);
+            chunk.vertexWeights.push_back(r);
+            chunk.colors.push_back(r);
+            chunk.colors.push_back(g);
+            chunk.colors.push_back(b);
+        }
+        else if (token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2]))
+        {
+            token += 3;
+            tinyobj::real_t x, y, z;
+            tinyobj::parseReal3(&x, &y, &z, &token);
+            chunk.normals.push_back(x);
+            chunk.normals.push_back(y);
+            chunk.normals.push_back(z);
+        }
+        else if (token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2]))
+        {
+            token += 3;
+            tinyobj::real_t x, y;
+            tinyobj::parseReal2(&x, &y, &token);
+            chunk.texcoords.push_back(x);
+            chunk.texcoords.push_back(y);
+        }
+        else if (token[0] == 'f' && IS_SPACE(token[1]))
+        {
+            token += 2;
+            token += strspn(token, " \t");
+
+            unsigned int faceSize = 0;
+            while (!IS_NEW_LINE(token[0]) && token[0] != '#')
+            {
+                ObjChunkCorner corner;
+                if (!parseObjCorner(&token, chunk, corner))
+                {
+                    chunk.supported = false;
+                    break;
+                }
+                chunk.corners.push_back(corner);
+                faceSize++;
+                token += strspn(token, " \t\r");
+            }
+
+            // Degenerate faces and polygons beyond quads take LoadObj's own paths.
+            if (faceSize < 3 || faceSize > 4)
+                chunk.supported = false;
+            chunk.faceSizes.push_back(faceSize);
+            chunk.smoothingIds.push_back(smoothingId);
+        }
+        else if (token[0] == 'g' && IS_SPACE(token[1]))
+        {
+            std::vector<std::string> names;
+            while (!IS_NEW_LINE(token[0]) && token[0] != '#')
+            {
+                names.push_back(tinyobj::parseString(&token));
+                token += strspn(token, " \t\r");
+            }
+            if (names.size() < 2)
+            {
+                chunk.supported = false;
+                break;
+            }
+
+            std::string name = names[1];
+            for (size_t i = 2; i < names.size(); i++)
+                name += " " + names[i];
+            chunk.breaks.push_back({chunk.faceSizes.size(), name});
+        }
+        else if (token[0] == 'o' && IS_SPACE(token[1]))
+        {
+            chunk.breaks.push_back({chunk.faceSizes.size(), std::string(token + 2)});
+        }
+        else if (token[0] == 's' && IS_SPACE(token[1]))
+        {
+            token += 2;
+            token += strspn(token, " \t");
+            if (token[0] == '\0' || token[0] == '\r' || token[1] == '\n')
+                continue;
+
+            if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' && token[2] == 'f')
+            {
+                smoothingId = 0;
+            }
+            else
+            {
+                int groupId = tinyobj::parseInt(&token);
+                smoothingId = groupId < 0 ? 0 : static_cast<unsigned int>(groupId);
+            }
+            chunk.lastSmoothingId = smoothingId;
+        }
+        else if ((token[0] == 'v' && token[1] == 'w' && IS_SPACE(token[2])) ||
+                 (token[0] == 'l' && IS_SPACE(token[1])) ||
+                 (token[0] == 'p' && IS_SPACE(token[1])) ||
+                 (token[0] == 't' && IS_SPACE(token[1])) ||
+                 strncmp(token, "usemtl", 6) == 0 ||
+                 (strncmp(token, "mtllib", 6) == 0 && IS_SPACE(token[6])))
+        {
+            chunk.supported = false;
+        }
+        // Anything else is ignored, exactly as LoadObj does.
+    }
+}
+
+bool resolveObjIndex(int &index, bool relative, size_t base, size_t count)
+{
+    if (relative)
+        index += static_cast<int>(base);
+    if (relative && index < 0)
+        return false;
+    return index < static_cast<int>(count);
+}
+
+// Second pass: turn raw corners into final tinyobj indices and triangulate
+// quads with the same shortest-diagonal rule LoadObj uses. Output is one
+// mesh segment per run of faces between shape breaks.
+void triangulateObjChunk(ObjChunk &chunk, const std::vector<tinyobj::real_t> &vertices,
+                         size_t normalCount, size_t texcoordCount, unsigned int inheritedSmoothingId)
+{
+    size_t vertexCount = vertices.size() / 3;
+    size_t breakIndex = 0;
+    size_t cornerIndex = 0;
+
+    chunk.segments.assign(chunk.breaks.size() + 1, tinyobj::mesh_t());
+
+    for (size_t face = 0; face < chunk.faceSizes.size(); face++)
+    {
+        while (breakIndex < chunk.breaks.size() && chunk.breaks[breakIndex].faceIndex <= face)
+            breakIndex++;
+        tinyobj::mesh_t &segment = chunk.segments[breakIndex];
+
+        tinyobj::index_t idx[4];
+        unsigned int faceSize = chunk.faceSizes[face];
+        for (unsigned int k = 0; k < faceSize; k++)
+        {
+            ObjChunkCorner corner = chunk.corners[cornerIndex + k];
+            bool valid = resolveObjIndex(corner.v, corner.relative & OBJ_RELATIVE_V, chunk.vertexBase, vertexCount) &&
+                         resolveObjIndex(corner.vt, corner.relative & OBJ_RELATIVE_VT, chunk.texcoordBase, texcoordCount) &&
+                         resolveObjIndex(corner.vn, corner.relative & OBJ_RELATIVE_VN, chunk.normalBase, normalCount);
+            if (!valid)
+            {
+                chunk.supported = false;
+                return;
+            }
+            idx[k].vertex_index = corner.v;
+            idx[k].texcoord_index = corner.vt;
+            idx[k].normal_index = corner.vn;
+        }
+        cornerIndex += faceSize;
+
+        unsigned int smoothingId = chunk.smoothingIds[face];
+        if (smoothingId == OBJ_INHERIT_SMOOTHING)
+            smoothingId = inheritedSmoothingId;
+
+        if (faceSize == 3)
+        {
+            segment.indices.insert(segment.indices.end(), idx, idx + 3);
+            segment.num_face_vertices.push_back(3);
+            segment.smoothing_group_ids.push_back(smoothingId);
+            continue;
+        }
+
+        const tinyobj::real_t *v0 = &vertices[3 * idx[0].vertex_index];
+        const tinyobj::real_t *v1 = &vertices[3 * idx[1].vertex_index];
+        const tinyobj::real_t *v2 = &vertices[3 * idx[2].vertex_index];
+        const tinyobj::real_t *v3 = &vertices[3 * idx[3].vertex_index];
+        tinyobj::real_t e02x = v2[0] - v0[0];
+        tinyobj::real_t e02y = v2[1] - v0[1];
+        tinyobj::real_t e02z = v2[2] - v0[2];
+        tinyobj::real_t e13x = v3[0] - v1[0];
+        tinyobj::real_t e13y = v3[1] - v1[1];
+        tinyobj::real_t e13z = v3[2] - v1[2];
+        tinyobj::real_t sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+        tinyobj::real_t sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+
+        if (sqr02 < sqr13)
+        {
+            tinyobj::index_t triangles[6] = {idx[0], idx[1], idx[2], idx[0], idx[2], idx[3]};
+            segment.indices.insert(segment.indices.end(), triangles, triangles + 6);
+        }
+        else
+        {
+            tinyobj::index_t triangles[6] = {idx[0], idx[1], idx[3], idx[1], idx[2], idx[3]};
+            segment.indices.insert(segment.indices.end(), triangles, triangles + 6);
+        }
+        segment.num_face_vertices.push_back(3);
+        segment.num_face_vertices.push_back(3);
+        segment.smoothing_group_ids.push_back(smoothingId);
+        segment.smoothing_group_ids.push_back(smoothingId);
+    }
+}
+
+void appendObjSegment(tinyobj::mesh_t &mesh, const tinyobj::mesh_t &segment)
+{
+    mesh.indices.insert(mesh.indices.end(), segment.indices.begin(), segment.indices.end());
+    mesh.num_face_vertices.insert(mesh.num_face_vertices.end(),
+                                  segment.num_face_vertices.begin(), segment.num_face_vertices.end());
+    mesh.smoothing_group_ids.insert(mesh.smoothing_group_ids.end(),
+                                    segment.smoothing_group_ids.begin(), segment.smoothing_group_ids.end());
+    mesh.material_ids.resize(mesh.num_face_vertices.size(), -1);
+}
+
+template <typename T>
+void appendChunkArrays(std::vector<T> &out, const std::vector<ObjChunk> &chunks, std::vector<T> ObjChunk::*member)
+{
+    size_t total = 0;
+    for (const ObjChunk &chunk : chunks)
+        total += (chunk.*member).size();
+    out.reserve(total);
+    for (const ObjChunk &chunk : chunks)
+        out.insert(out.end(), (chunk.*member).begin(), (chunk.*member).end());
+}
+
+// Persistent threads for the data-parallel loops in runOnWorkers, started
+// on first use (hardware threads - 1; the caller is the last one). One loop
+// runs at a time: the caller publishes it under the mutex, every thread and
+// the caller take indices from `next`, and the caller waits for `active` to
+// reach zero before work goes out of scope.
+struct WorkerPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::mutex loopMutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(size_t)> *work = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next{0};
+    size_t active = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+};
+
+WorkerPool workerPool;
+
+// Set on pool threads and asset loader workers. runOnWorkers called from
+// one runs the loop inline, so nested parallel work (a mip chain encoded
+// by a loader worker) never multiplies the thread count.
+thread_local bool onWorkerThread = false;
+
+void runWorkerPoolThread()
+{
+    onWorkerThread = true;
+    uint64_t seen = 0;
+    for (;;)
+    {
+        const std::function<void(size_t)> *work;
+        size_t count;
+        {
+            std::unique_lock<std::mutex> lock(workerPool.mutex);
+            workerPool.wake.wait(lock, [&] { return workerPool.stopping || workerPool.generation != seen; });
+            if (workerPool.stopping)
+                return;
+            seen = workerPool.generation;
+            work = workerPool.work;
+            count = workerPool.count;
+        }
+        for (size_t i = workerPool.next++; i < count; i = workerPool.next++)
+            (*work)(i);
+        std::lock_guard<std::mutex> lock(workerPool.mutex);
+        if (--workerPool.active == 0)
+            workerPool.finished.notify_one();
+    }
+}
+
+// Runs work(0) .. work(count - 1) across the pool and the calling thread.
+// Falls back to a plain loop on a worker thread, on a single-core machine,
+// or while another thread's loop holds the pool.
+void runOnWorkers(size_t count, const std::function<void(size_t)> &work)
+{
+    std::unique_lock<std::mutex> loop(workerPool.loopMutex, std::defer_lock);
+    if (count <= 1 || onWorkerThread || std::thread::hardware_concurrency() <= 1 || !loop.try_lock())
+    {
+        for (size_t i = 0; i < count; i++)
+            work(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(workerPool.mutex);
+        if (workerPool.threads.empty())
+        {
+            for (unsigned int i = 1; i < std::thread::hardware_concurrency(); i++)
+                workerPool.threads.emplace_back(runWorkerPoolThread);
+        }
+        workerPool.work = &work;
+        workerPool.count = count;
+        workerPool.next = 0;
+        workerPool.active = workerPool.threads.size();
+        workerPool.generation++;
+    }
+    workerPool.wake.notify_all();
+
+    for (size_t i = workerPool.next++; i < count; i = workerPool.next++)
+        work(i);
+    std::unique_lock<std::mutex> lock(workerPool.mutex);
+    workerPool.finished.wait(lock, [] { return workerPool.active == 0; });
+}
+
+// Parses an OBJ with the same output as tinyobj::LoadObj (triangulated, no
+// materials), but over an mmapped file split at line boundaries and parsed
+// on all cores. Files using features outside the fast subset go through
+// tinyobj::LoadObj unchanged.
+bool loadObjParallel(const char *path, tinyobj::attrib_t *attrib, std::vector<tinyobj::shape_t> *shapes,
+                     std::string *warn, std::string *err)
+{
+    std::vector<tinyobj::material_t> materials;
+    MappedFile mapped;
+    if (!mapFile(path, mapped))
+        return tinyobj::LoadObj(attrib, shapes, &materials, warn, err, path);
+
+    const size_t MIN_CHUNK_BYTES = 256 * 1024;
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(),
+                                                             mapped.size / MIN_CHUNK_BYTES));
+
+    const char *fileBegin = reinterpret_cast<const char *>(mapped.data);
+    const char *fileEnd = fileBegin + mapped.size;
+    std::vector<ObjChunk> chunks(chunkCount);
+    const char *chunkBegin = fileBegin;
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        const char *chunkEnd = fileBegin + mapped.size * (i + 1) / chunkCount;
+        if (i + 1 == chunkCount)
+        {
+            chunkEnd = fileEnd;
+        }
+        else
+        {
+            chunkEnd = std::max(chunkEnd, chunkBegin);
+            const char *newline = static_cast<const char *>(memchr(chunkEnd, '\n', fileEnd - chunkEnd));
+            chunkEnd = newline ? newline + 1 : fileEnd;
+        }
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    runOnWorkers(chunkCount, [&](size_t i) { parseObjChunk(chunks[i]); });
+
+    bool supported = true;
+    size_t vertexCount = 0, normalCount = 0, texcoordCount = 0;
+    std::vector<unsigned int> inheritedSmoothing(chunkCount, 0);
+    unsigned int smoothingId = 0;
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        ObjChunk &chunk = chunks[i];
+        supported &= chunk.supported;
+        chunk.vertexBase = vertexCount;
+        chunk.normalBase = normalCount;
+        chunk.texcoordBase = texcoordCount;
+        vertexCount += chunk.vertices.size() / 3;
+        normalCount += chunk.normals.size() / 3;
+        texcoordCount += chunk.texcoords.size() / 2;
+        inheritedSmoothing[i] = smoothingId;
+        if (chunk.lastSmoothingId != OBJ_INHERIT_SMOOTHING)
+            smoothingId = chunk.lastSmoothingId;
+    }
+
+    if (!supported)
+    {
+        unmapFile(mapped);
+        return tinyobj::LoadObj(attrib, shapes, &materials, warn, err, path);
+    }
+
+    tinyobj::attrib_t result;
+    appendChunkArrays(result.vertices, chunks, &ObjChunk::vertices);
+
+    runOnWorkers(chunkCount, [&](size_t i) {
+        triangulateObjChunk(chunks[i], result.vertices, normalCount, texcoordCount, inheritedSmoothing[i]);
+    });
+
+    for (const ObjChunk &chunk : chunks)
+        supported &= chunk.supported;
+    if (!supported)
+    {
+        unmapFile(mapped);
+        return tinyobj::LoadObj(attrib, shapes, &materials, warn, err, path);
+    }
+
+    appendChunkArrays(result.vertex_weights, chunks, &ObjChunk::vertexWeights);
+    appendChunkArrays(result.normals, chunks, &ObjChunk::normals);
+    appendChunkArrays(result.texcoords, chunks, &ObjChunk::texcoords);
+    appendChunkArrays(result.colors, chunks, &ObjChunk::colors);
+
+    // Replay shape breaks in file order. A shape is only emitted when it
+    // received faces, and it takes the name of the g/o line that opened it.
+    shapes->clear();
+    tinyobj::shape_t shape;
+    std::string name;
+    for (ObjChunk &chunk : chunks)
+    {
+        for (size_t segment = 0; segment < chunk.segments.size(); segment++)
+        {
+            if (segment > 0)
+            {
+                if (!shape.mesh.indices.empty())
+                {
+                    shape.name = name;
+                    shapes->push_back(std::move(shape));
+                }
+                shape = tinyobj::shape_t();
+                name = chunk.breaks[segment - 1].name;
+            }
+            appendObjSegment(shape.mesh, chunk.segments[segment]);
+        }
+    }
+    if (!shape.mesh.indices.empty())
+    {
+        shape.name = name;
+        shapes->push_back(std::move(shape));
+    }
+
+    unmapFile(mapped);
+    *attrib = std::move(result);
+    return true;
+}
+
+// Streaming import state for LoadObjWithCallback. Only the raw v/vn/vt pools
+// (which faces index into) and the final welded arrays are kept; there is no
+// attrib_t, no shape list and no per-corner copy. Welding uses an
+// open-addressed table of vertex ids instead of std::unordered_map so the
+// bookkeeping costs about 20 bytes per unique vertex.
+struct StreamingObjImport {
+    std::vector<float> positions, normals, texcoords;
+    std::vector<VertexKey> keys;
+    std::vector<unsigned int> table;
+    std::vector<unsigned int> face;
+    MeshData mesh;
+    size_t skippedFaces = 0;
+};
+
+const unsigned int EMPTY_SLOT = 0xffffffffu;
+
+void growWeldTable(StreamingObjImport &import)
+{
+    std::vector<unsigned int> table(import.table.empty() ? 1024 : import.table.size() * 2, EMPTY_SLOT);
+    size_t mask = table.size() - 1;
+    for (unsigned int id = 0; id < import.keys.size(); id++)
+    {
+        size_t slot = VertexKeyHash()(import.keys[id]) & mask;
+        while (table[slot] != EMPTY_SLOT)
+            slot = (slot + 1) & mask;
+        table[slot] = id;
+    }
+    import.table.swap(table);
+}
+
+unsigned int weldStreamingVertex(StreamingObjImport &import, const VertexKey &key)
+{
+    // Keep the table at most half full.
+    if ((import.keys.size() + 1) * 2 > import.table.size())
+        growWeldTable(import);
+
+    size_t mask = import.table.size() - 1;
+    size_t slot = VertexKeyHash()(key) & mask;
+    while (import.table[slot] != EMPTY_SLOT)
+    {
+        if (import.keys[import.table[slot]] == key)
+            return import.table[slot];
+        slot = (slot + 1) & mask;
+    }
+
+    unsigned int id = static_cast<unsigned int>(import.keys.size());
+    import.table[slot] = id;
+    import.keys.push_back(key);
+
+    std::vector<float> &vertices = import.mesh.vertices;
+    vertices.insert(vertices.end(), &import.positions[3 * key.vertexIndex], &import.positions[3 * key.vertexIndex] + 3);
+    if (key.normalIndex >= 0)
+    {
+        vertices.insert(vertices.end(), &import.normals[3 * key.normalIndex], &import.normals[3 * key.normalIndex] + 3);
+    }
+    else
+    {
+        vertices.push_back(0.0f);
+        vertices.push_back(0.0f);
+        vertices.push_back(1.0f);
+    }
+    if (key.texcoordIndex >= 0)
+    {
+        vertices.insert(vertices.end(), &import.texcoords[2 * key.texcoordIndex], &import.texcoords[2 * key.texcoordIndex] + 2);
+    }
+    else
+    {
+        vertices.push_back(0.0f);
+        vertices.push_back(0.0f);
+    }
+    return id;
+}
+
+// Converts a raw 1-based / negative-relative OBJ index to a 0-based one.
+// Returns -1 for an absent (0) index and -2 for one that is out of range.
+int resolveStreamingIndex(int raw, size_t count)
+{
+    if (raw == 0)
+        return -1;
+    long long index = raw > 0 ? static_cast<long long>(raw) - 1 : static_cast<long long>(count) + raw;
+    return (index < 0 || index >= static_cast<long long>(count)) ? -2 : static_cast<int>(index);
+}
+
+void streamingVertexCallback(void *userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t)
+{
+    std::vector<float> &positions = static_cast<StreamingObjImport *>(userData)->positions;
+    positions.push_back(x);
+    positions.push_back(y);
+    positions.push_back(z);
+}
+
+void streamingNormalCallback(void *userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z)
+{
+    std::vector<float> &normals = static_cast<StreamingObjImport *>(userData)->normals;
+    normals.push_back(x);
+    normals.push_back(y);
+    normals.push_back(z);
+}
+
+void streamingTexcoordCallback(void *userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t)
+{
+    std::vector<float> &texcoords = static_cast<StreamingObjImport *>(userData)->texcoords;
+    texcoords.push_back(x);
+    texcoords.push_back(y);
+}
+
+void streamingIndexCallback(void *userData, tinyobj::index_t *indices, int numIndices)
+{
+    StreamingObjImport &import = *static_cast<StreamingObjImport *>(userData);
+    if (numIndices < 3)
+    {
+        import.skippedFaces++;
+        return;
+    }
+
+    import.face.clear();
+    for (int i = 0; i < numIndices; i++)
+    {
+        VertexKey key;
+        key.vertexIndex = resolveStreamingIndex(indices[i].vertex_index, import.positions.size() / 3);
+        key.normalIndex = resolveStreamingIndex(indices[i].normal_index, import.normals.size() / 3);
+        key.texcoordIndex = resolveStreamingIndex(indices[i].texcoord_index, import.texcoords.size() / 2);
+        if (key.vertexIndex < 0 || key.normalIndex == -2 || key.texcoordIndex == -2)
+        {
+            import.skippedFaces++;
+            return;
+        }
+        import.face.push_back(weldStreamingVertex(import, key));
+    }
+
+    std::vector<unsigned int> &out = import.mesh.indices;
+    const std::vector<unsigned int> &face = import.face;
+    if (face.size() == 4)
+    {
+        // Split quads along the shorter diagonal, like tinyobj::LoadObj.
+        const float *v = import.mesh.vertices.data();
+        glm::vec3 p0 = glm::make_vec3(v + face[0] * VERTEX_STRIDE);
+        glm::vec3 p1 = glm::make_vec3(v + face[1] * VERTEX_STRIDE);
+        glm::vec3 p2 = glm::make_vec3(v + face[2] * VERTEX_STRIDE);
+        glm::vec3 p3 = glm::make_vec3(v + face[3] * VERTEX_STRIDE);
+        glm::vec3 e02 = p2 - p0, e13 = p3 - p1;
+        if (glm::dot(e02, e02) < glm::dot(e13, e13))
+            out.insert(out.end(), {face[0], face[1], face[2], face[0], face[2], face[3]});
+        else
+            out.insert(out.end(), {face[0], face[1], face[3], face[1], face[2], face[3]});
+        return;
+    }
+
+    for (size_t i = 1; i + 1 < face.size(); i++)
+        out.insert(out.end(), {face[0], face[i], face[i + 1]});
+}
+
+// Builds the welded mesh straight from LoadObjWithCallback, so peak memory
+// stays close to the raw attribute pools plus the final GPU arrays.
+bool importObjStreaming(const char *path, MeshData &mesh, std::string *warn, std::string *err)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        *err = std::string("Cannot open file [") + path + "]\n";
+        return false;
+    }
+
+    tinyobj::callback_t callbacks;
+    callbacks.vertex_cb = streamingVertexCallback;
+    callbacks.normal_cb = streamingNormalCallback;
+    callbacks.texcoord_cb = streamingTexcoordCallback;
+    callbacks.index_cb = streamingIndexCallback;
+
+    StreamingObjImport import;
+    if (!tinyobj::LoadObjWithCallback(file, callbacks, &import, NULL, warn, err))
+        return false;
+
+    if (import.skippedFaces > 0)
+        *warn += std::to_string(import.skippedFaces) + " degenerate or invalid faces skipped\n";
+
+    mesh = std::move(import.mesh);
+    mesh.vertices.shrink_to_fit();
+    mesh.indices.shrink_to_fit();
+    computeBounds(mesh);
+    return true;
+}
+
+enum class ObjImportMode {
+    Parallel,
+    Streaming,
+};
+
+// Streaming trades the parallel parser's speed for a much smaller peak
+// footprint; select it with --streaming-import on memory-constrained machines.
+ObjImportMode objImportMode = ObjImportMode::Parallel;
+
+bool importObj(const char *path, MeshData &mesh, std::string *warn, std::string *err)
+{
+    if (objImportMode == ObjImportMode::Streaming)
+        return importObjStreaming(path, mesh, warn, err);
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    if (!loadObjParallel(path, &attrib, &shapes, warn, err))
+        return false;
+    mesh = buildMeshData(attrib, shapes);
+    return true;
+}
+
+struct VertexCacheStats {
+    float acmr;
+    float atvr;
+};
+
+// Simulates a FIFO post-transform cache. ACMR is transformed vertices per
+// triangle (0.5 is ideal on regular grids, 3.0 is no reuse at all) and ATVR
+// is transformed vertices per unique vertex (1.0 is ideal).
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize)
+{
+    VertexCacheStats stats = {0.0f, 0.0f};
+    if (indices.empty() || vertexCount == 0)
+        return stats;
+
+    std::vector<unsigned int> insertedAt(vertexCount, 0);
+    unsigned int timestamp = cacheSize + 1;
+    size_t misses = 0;
+    for (unsigned int index : indices)
+    {
+        if (timestamp - insertedAt[index] > cacheSize)
+        {
+            insertedAt[index] = timestamp++;
+            misses++;
+        }
+    }
+
+    stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+    stats.atvr = static_cast<float>(misses) / static_cast<float>(vertexCount);
+    return stats;
+}
+
+// Reorders triangles for post-transform cache locality using Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation": each vertex is scored by its
+// position in a simulated LRU cache plus a bonus for few remaining triangles,
+// and the highest scoring triangle touching the cache is emitted next.
+void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertexCount)
+{
+    const int CACHE_SIZE = 32;
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+    const int MAX_VALENCE = 64;
+
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    float cacheScores[CACHE_SIZE];
+    for (int i = 0; i < CACHE_SIZE; i++)
+    {
+        if (i < 3)
+            cacheScores[i] = LAST_TRIANGLE_SCORE;
+        else
+            cacheScores[i] = std::pow(1.0f - static_cast<float>(i - 3) / (CACHE_SIZE - 3), CACHE_DECAY_POWER);
+    }
+    float valenceScores[MAX_VALENCE + 1];
+    valenceScores[0] = 0.0f;
+    for (int i = 1; i <= MAX_VALENCE; i++)
+        valenceScores[i] = VALENCE_BOOST_SCALE * std::pow(static_cast<float>(i), -VALENCE_BOOST_POWER);
+
+    // Vertex -> triangle adjacency in CSR form.
+    std::vector<unsigned int> adjacencyOffsets(vertexCount + 1, 0);
+    for (unsigned int index : indices)
+        adjacencyOffsets[index + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+
+    std::vector<unsigned int> liveTriangles(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        liveTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    auto vertexScore = [&](unsigned int v) {
+        if (liveTriangles[v] == 0)
+            return -1.0f;
+        float score = cachePosition[v] >= 0 ? cacheScores[cachePosition[v]] : 0.0f;
+        return score + valenceScores[std::min<unsigned int>(liveTriangles[v], MAX_VALENCE)];
+    };
+
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        vertexScores[v] = vertexScore(static_cast<unsigned int>(v));
+
+    std::vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+
+    // The cache holds CACHE_SIZE entries plus room for the 3 just pushed.
+    std::vector<unsigned int> cache, nextCache;
+    cache.reserve(CACHE_SIZE + 3);
+    nextCache.reserve(CACHE_SIZE + 3);
+
+    size_t scanCursor = 0;
+    long long bestTriangle = 0;
+    for (size_t t = 1; t < triangleCount; t++)
+    {
+        if (triangleScores[t] > triangleScores[bestTriangle])
+            bestTriangle = static_cast<long long>(t);
+    }
+
+    while (bestTriangle >= 0)
+    {
+        size_t t = static_cast<size_t>(bestTriangle);
+        emitted[t] = true;
+        const unsigned int *tri = &indices[3 * t];
+        result.insert(result.end(), tri, tri + 3);
+
+        // Remove the triangle from its vertices' live lists.
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = tri[k];
+            unsigned int *begin = &adjacency[adjacencyOffsets[v]];
+            unsigned int *end = begin + liveTriangles[v];
+            unsigned int *found = std::find(begin, end, static_cast<unsigned int>(t));
+            std::swap(*found, *(end - 1));
+            liveTriangles[v]--;
+        }
+
+        // Push the triangle's vertices to the front of the LRU cache.
+        nextCache.assign(tri, tri + 3);
+        for (unsigned int v : cache)
+        {
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                nextCache.push_back(v);
+        }
+        for (size_t i = 0; i < nextCache.size(); i++)
+            cachePosition[nextCache[i]] = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+
+        // Rescore every vertex that was or is in the cache, and the live
+        // triangles around them, while looking for the next best triangle.
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : nextCache)
+        {
+            float newScore = vertexScore(v);
+            float delta = newScore - vertexScores[v];
+            vertexScores[v] = newScore;
+            for (unsigned int i = 0; i < liveTriangles[v]; i++)
+            {
+                unsigned int neighbour = adjacency[adjacencyOffsets[v] + i];
+                triangleScores[neighbour] += delta;
+                if (triangleScores[neighbour] > bestScore)
+                {
+                    bestScore = triangleScores[neighbour];
+                    bestTriangle = neighbour;
+                }
+            }
+        }
+
+        if (nextCache.size() > CACHE_SIZE)
+            nextCache.resize(CACHE_SIZE);
+        cache.swap(nextCache);
+
+        // Nothing in the cache has live triangles left: restart elsewhere.
+        if (bestTriangle < 0)
+        {
+            while (scanCursor < triangleCount && emitted[scanCursor])
+                scanCursor++;
+            if (scanCursor < triangleCount)
+                bestTriangle = static_cast<long long>(scanCursor);
+        }
+    }
+
+    indices.swap(result);
+}
+
+// Renumbers vertices in the order the index buffer first references them,
+// so vertex fetch walks the VBO roughly sequentially.
+void optimizeVertexFetch(MeshData &mesh)
+{
+    size_t vertexCount = mesh.vertices.size() / VERTEX_STRIDE;
+    std::vector<unsigned int> remap(vertexCount, 0xffffffffu);
+    std::vector<float> vertices;
+    vertices.reserve(mesh.vertices.size());
+
+    unsigned int nextVertex = 0;
+    for (unsigned int &index : mesh.indices)
+    {
+        if (remap[index] == 0xffffffffu)
+        {
+            remap[index] = nextVertex++;
+            const float *source = &mesh.vertices[index * VERTEX_STRIDE];
+            vertices.insert(vertices.end(), source, source + VERTEX_STRIDE);
+        }
+        index = remap[index];
+    }
+
+    // Vertices no triangle uses are dropped.
+    mesh.vertices.swap(vertices);
+}
+
+// Splits the cache-ordered triangle list into clusters and draws the
+// clusters facing away from the mesh centre first, after Sander et al.
+// "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw".
+// Hard cluster boundaries are where the FIFO cache restarts (a triangle
+// misses on all three vertices); clusters are then cut further wherever the
+// running ACMR is already within `threshold` of the cluster's, so sorting
+// costs at most that much vertex cache efficiency.
+void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<float> &vertices, float threshold)
+{
+    const unsigned int CACHE_SIZE = 16;
+    size_t triangleCount = indices.size() / 3;
+    size_t vertexCount = vertices.size() / VERTEX_STRIDE;
+    if (triangleCount < 2)
+        return;
+
+    std::vector<unsigned int> insertedAt(vertexCount, 0);
+    unsigned int timestamp = CACHE_SIZE + 1;
+    auto triangleMisses = [&](size_t t) {
+        unsigned int misses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = indices[3 * t + k];
+            if (timestamp - insertedAt[v] > CACHE_SIZE)
+            {
+                insertedAt[v] = timestamp++;
+                misses++;
+            }
+        }
+        return misses;
+    };
+    auto resetCache = [&]() { timestamp += CACHE_SIZE + 1; };
+
+    std::vector<size_t> hardClusters;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        if (triangleMisses(t) == 3 || t == 0)
+            hardClusters.push_back(t);
+    }
+    hardClusters.push_back(triangleCount);
+
+    std::vector<size_t> clusters;
+    for (size_t c = 0; c + 1 < hardClusters.size(); c++)
+    {
+        size_t start = hardClusters[c], end = hardClusters[c + 1];
+
+        resetCache();
+        unsigned int clusterMisses = 0;
+        for (size_t t = start; t < end; t++)
+            clusterMisses += triangleMisses(t);
+        float clusterAcmr = static_cast<float>(clusterMisses) / (end - start);
+
+        resetCache();
+        clusters.push_back(start);
+        unsigned int misses = 0;
+        size_t subStart = start;
+        for (size_t t = start; t < end; t++)
+        {
+            misses += triangleMisses(t);
+            float acmr = static_cast<float>(misses) / (t + 1 - subStart);
+            if (t + 1 < end && acmr <= clusterAcmr * threshold)
+            {
+                subStart = t + 1;
+                clusters.push_back(subStart);
+                misses = 0;
+                resetCache();
+            }
+        }
+    }
+    clusters.push_back(triangleCount);
+
+    glm::vec3 meshCentroid(0.0f);
+    for (size_t v = 0; v < vertexCount; v++)
+        meshCentroid += glm::make_vec3(&vertices[v * VERTEX_STRIDE]);
+    meshCentroid /= static_cast<float>(vertexCount);
+
+    struct ClusterKey {
+        float key;
+        size_t cluster;
+    };
+    std::vector<ClusterKey> keys;
+    for (size_t c = 0; c + 1 < clusters.size(); c++)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+        {
+            glm::vec3 p0 = glm::make_vec3(&vertices[indices[3 * t + 0] * VERTEX_STRIDE]);
+            glm::vec3 p1 = glm::make_vec3(&vertices[indices[3 * t + 1] * VERTEX_STRIDE]);
+            glm::vec3 p2 = glm::make_vec3(&vertices[indices[3 * t + 2] * VERTEX_STRIDE]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(n);
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        if (area > 0.0f)
+            centroid /= area;
+        float normalLength = glm::length(normal);
+        if (normalLength > 0.0f)
+            normal /= normalLength;
+        keys.push_back({glm::dot(centroid - meshCentroid, normal), c});
+    }
+
+    std::stable_sort(keys.begin(), keys.end(), [](const ClusterKey &a, const ClusterKey &b) { return a.key > b.key; });
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (const ClusterKey &key : keys)
+        result.insert(result.end(), indices.begin() + 3 * clusters[key.cluster], indices.begin() + 3 * clusters[key.cluster + 1]);
+    indices.swap(result);
+}
+
+// Overdraw sorting may cost at most this factor in ACMR.
+const float OVERDRAW_THRESHOLD = 1.05f;
+
+// Set with --no-mesh-optimize to keep the OBJ's own triangle order.
+bool optimizeMeshes = true;
+
+void optimizeMesh(MeshData &mesh, const char *path)
+{
+    const unsigned int STATS_CACHE_SIZE = 16;
+    size_t vertexCount = mesh.vertices.size() / VERTEX_STRIDE;
+
+    VertexCacheStats before = analyzeVertexCache(mesh.indices, vertexCount, STATS_CACHE_SIZE);
+    optimizeVertexCache(mesh.indices, vertexCount);
+    optimizeOverdraw(mesh.indices, mesh.vertices, OVERDRAW_THRESHOLD);
+    optimizeVertexFetch(mesh);
+    VertexCacheStats after = analyzeVertexCache(mesh.indices, mesh.vertices.size() / VERTEX_STRIDE, STATS_CACHE_SIZE);
+
+    std::cout << "Optimized " << path << ": ACMR " << before.acmr << " -> " << after.acmr
+              << ", ATVR " << before.atvr << " -> " << after.atvr
+              << " (FIFO " << STATS_CACHE_SIZE << ")" << std::endl;
+}
+
+// A current .meshcache, mapped: the model without GL objects, and the
+// encoded vertex and index bytes, which point into the mapping.
+struct MeshCacheView {
+    MappedFile mapped;
+    Model model;
+    const unsigned char *vertices = nullptr;
+    size_t vertexSize = 0;
+    const unsigned char *indices = nullptr;
+    size_t indexSize = 0;
+};
+
+// Maps the OBJ's cache if it is current for the source and this run's
+// settings. The caller unmaps view.mapped when done with the bytes.
+bool mapMeshCache(const char *path, MeshCacheView &view)
+{
+    std::string cachePath = std::string(path) + ".meshcache";
+    uint32_t cacheFlags = optimizeMeshes ? MESH_CACHE_OPTIMIZED : 0;
+    const MeshCacheHeader *header = openMeshCache(cachePath, path, cacheFlags, view.mapped);
+    if (!header)
+        return false;
+
+    view.model.indexCount = header->indexCount;
+    view.model.indexType = header->indexType;
+    view.model.boundsMin = glm::make_vec3(header->boundsMin);
+    view.model.boundsMax = glm::make_vec3(header->boundsMax);
+    view.model.positionScale = glm::make_vec3(header->positionScale);
+    view.model.positionOffset = glm::make_vec3(header->positionOffset);
+    view.vertices = view.mapped.data + sizeof(MeshCacheHeader);
+    view.vertexSize = static_cast<size_t>(header->vertexCount) * header->vertexStride;
+    view.indices = view.vertices + view.vertexSize;
+    view.indexSize = static_cast<size_t>(header->indexCount) * meshIndexSize(header->indexType);
+    return true;
+}
+
+// Imports the OBJ, welds, optimizes and encodes it, and rewrites its cache.
+bool importPreparedMesh(const char *path, PreparedMesh &prepared)
+{
+    MeshData mesh;
+    std::string warn, err;
+    if (!importObj(path, mesh, &warn, &err))
+    {
+        std::cerr << "Failed to load OBJ file: " << warn << err << std::endl;
+        return false;
+    }
+
+    size_t vertexCount = mesh.vertices.size() / VERTEX_STRIDE;
+    size_t cornerCount = mesh.indices.size();
+    std::cout << "Loaded " << path << ": " << cornerCount << " corners welded into "
+              << vertexCount << " vertices ("
+              << cornerCount * VERTEX_STRIDE * sizeof(float) / 1024 << " KB -> "
+              << vertexCount * VERTEX_STRIDE * sizeof(float) / 1024 << " KB vertex data)" << std::endl;
+
+    if (optimizeMeshes)
+        optimizeMesh(mesh, path);
+
+    prepared = prepareMesh(mesh);
+    uint32_t cacheFlags = optimizeMeshes ? MESH_CACHE_OPTIMIZED : 0;
+    writeMeshCache(std::string(path) + ".meshcache", path, cacheFlags, prepared);
+    return true;
+}
+
+// The CPU half of loadOBJ: the encoded mesh from the cache if it is
+// current, otherwise imported.
+bool loadPreparedMesh(const char *path, PreparedMesh &prepared)
+{
+    MeshCacheView cache;
+    if (mapMeshCache(path, cache))
+    {
+        prepared.model = cache.model;
+        prepared.vertexBytes.assign(cache.vertices, cache.vertices + cache.vertexSize);
+        prepared.indexBytes.assign(cache.indices, cache.indices + cache.indexSize);
+        unmapFile(cache.mapped);
+        return true;
+    }
+    return importPreparedMesh(path, prepared);
+}
+
+Model loadOBJ(const char *path)
+{
+    // A current cache is uploaded straight from the mapping.
+    MeshCacheView cache;
+    if (mapMeshCache(path, cache))
+    {
+        Model model = uploadMesh(cache.model, cache.vertices, cache.vertexSize, cache.indices, cache.indexSize);
+        unmapFile(cache.mapped);
+        return model;
+    }
+
+    PreparedMesh prepared;
+    if (!importPreparedMesh(path, prepared))
+        return Model();
+    return uploadMesh(prepared.model, prepared.vertexBytes.data(), prepared.vertexBytes.size(),
+                      prepared.indexBytes.data(), prepared.indexBytes.size());
+}
+
+// CPU mip chain generation. Each level is resampled from the previous one
+// (kept in float, so rounding does not accumulate) with a separable filter:
+// a vertical pass over whole rows, which is where SSE pays off, then a
+// horizontal pass over the half-height result. Colour channels of 3- and
+// 4-channel images are sRGB-encoded and filtered in linear light. Edges
+// wrap, matching the GL_REPEAT the textures are sampled with.
+enum class MipFilter {
+    Box,
+    Kaiser,
+    Lanczos
+};
+
+struct MipOptions {
+    MipFilter filter = MipFilter::Kaiser;
+    bool srgb = true;
+    // When >= 0, each level's alpha is rescaled so the fraction of texels at
+    // or above the cutoff matches the base level, keeping alpha-tested
+    // geometry from thinning out in the distance.
+    float alphaCutoff = -1.0f;
+};
+
+// Set with --mip-filter box|kaiser|lanczos, --mip-linear and --mip-alpha-coverage.
+MipOptions mipOptions;
+
+// Set with --gl-mipmaps to leave uncompressed textures to glGenerateMipmap.
+bool generateMipsOnCpu = true;
+
+// Set with --texture-scale 2|4|8 to decode JPEG textures at that fraction of
+// their size. stb_image drops the high DCT frequencies instead of decoding
+// and downsampling, so this is much cheaper than a full decode.
+int textureDecodeScale = 1;
+
+// Decodes an image for the uncompressed path, at textureDecodeScale. The
+// BCn and virtual texture caches always decode at full size, since they are
+// shared between runs. The scale is per thread, so asset workers can call this.
+unsigned char *loadTextureImage(const char *path, int &width, int &height, int &components)
+{
+    stbi_set_jpeg_scale_on_load_thread(textureDecodeScale);
+    unsigned char *pixels = stbi_load(path, &width, &height, &components, 0);
+    stbi_set_jpeg_scale_on_load_thread(1);
+    return pixels;
+}
+
+float besselI0(float x)
+{
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 20; k++)
+    {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+    }
+    return sum;
+}
+
+float sinc(float x)
+{
+    if (std::fabs(x) < 1e-5f)
+        return 1.0f;
+    float px = 3.14159265f * x;
+    return std::sin(px) / px;
+}
+
+float mipFilterRadius(MipFilter filter)
+{
+    return filter == MipFilter::Box ? 0.5f : 3.0f;
+}
+
+// x is in target texels.
+float mipFilterWeight(MipFilter filter, float x)
+{
+    const float RADIUS = 3.0f, KAISER_ALPHA = 4.0f;
+    x = std::fabs(x);
+    switch (filter)
+    {
+    case MipFilter::Box:
+        return x < 0.5f ? 1.0f : 0.0f;
+    case MipFilter::Lanczos:
+        return x < RADIUS ? sinc(x) * sinc(x / RADIUS) : 0.0f;
+    default:
+        if (x >= RADIUS)
+            return 0.0f;
+        return sinc(x) * besselI0(KAISER_ALPHA * std::sqrt(1.0f - (x / RADIUS) * (x / RADIUS))) / besselI0(KAISER_ALPHA);
+    }
+}
+
+// Normalized filter taps for resampling one axis from sourceSize to
+// targetSize texels, `taps` per target texel (unused taps weigh zero).
+struct MipTaps {
+    int taps = 0;
+    std::vector<int> sources;
+    std::vector<float> weights;
+};
+
+MipTaps buildMipTaps(int sourceSize, int targetSize, MipFilter filter)
+{
+    float scale = static_cast<float>(sourceSize) / targetSize;
+    float support = mipFilterRadius(filter) * scale;
+    int window = static_cast<int>(std::ceil(support * 2.0f)) + 2;
+
+    // Evaluate a generous window per target texel, then keep only the
+    // widest run of nonzero weights so no work is spent on zero taps.
+    std::vector<int> firsts(targetSize);
+    std::vector<float> raw(static_cast<size_t>(targetSize) * window);
+    MipTaps result;
+    std::vector<int> starts(targetSize);
+    for (int i = 0; i < targetSize; i++)
+    {
+        float center = (i + 0.5f) * scale - 0.5f;
+        firsts[i] = static_cast<int>(std::floor(center - support));
+        int firstNonzero = window, lastNonzero = -1;
+        for (int t = 0; t < window; t++)
+        {
+            float weight = mipFilterWeight(filter, (firsts[i] + t - center) / scale);
+            raw[static_cast<size_t>(i) * window + t] = weight;
+            if (weight != 0.0f)
+            {
+                firstNonzero = std::min(firstNonzero, t);
+                lastNonzero = t;
+            }
+        }
+        starts[i] = firstNonzero;
+        result.taps = std::max(result.taps, lastNonzero - firstNonzero + 1);
+    }
+
+    result.sources.resize(static_cast<size_t>(targetSize) * result.taps);
+    result.weights.resize(static_cast<size_t>(targetSize) * result.taps);
+    for (int i = 0; i < targetSize; i++)
+    {
+        float total = 0.0f;
+        for (int t = 0; t < result.taps; t++)
+        {
+            int offset = starts[i] + t;
+            float weight = offset < window ? raw[static_cast<size_t>(i) * window + offset] : 0.0f;
+            int source = firsts[i] + offset;
+            result.sources[i * result.taps + t] = ((source % sourceSize) + sourceSize) % sourceSize;
+            result.weights[i * result.taps + t] = weight;
+            total += weight;
+        }
+        for (int t = 0; t < result.taps; t++)
+            result.weights[i * result.taps + t] /= total;
+    }
+    return result;
+}
+
+float srgbToLinear(float value)
+{
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+// One vertical output row: a weighted sum of whole source rows.
+void filterMipColumn(const float *source, float *target, size_t rowFloats, const int *rows, const float *weights, int taps)
+{
+    size_t x = 0;
+#ifdef MIP_USE_SSE
+    for (; x + 4 <= rowFloats; x += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+        for (int t = 0; t < taps; t++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(source + rows[t] * rowFloats + x)));
+        _mm_storeu_ps(target + x, sum);
+    }
+#endif
+    for (; x < rowFloats; x++)
+    {
+        float sum = 0.0f;
+        for (int t = 0; t < taps; t++)
+            sum += weights[t] * source[rows[t] * rowFloats + x];
+        target[x] = sum;
+    }
+}
+
+// One horizontal output row. Rows are padded by a texel so 3-channel texels
+// can be loaded four floats at a time.
+void filterMipRow(const float *source, float *target, int targetWidth, int components, const MipTaps &taps)
+{
+    for (int x = 0; x < targetWidth; x++)
+    {
+        const int *sources = &taps.sources[static_cast<size_t>(x) * taps.taps];
+        const float *weights = &taps.weights[static_cast<size_t>(x) * taps.taps];
+#ifdef MIP_USE_SSE
+        if (components >= 3)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int t = 0; t < taps.taps; t++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(source + sources[t] * components)));
+            float texel[4];
+            _mm_storeu_ps(texel, sum);
+            memcpy(target + x * components, texel, components * sizeof(float));
+            continue;
+        }
+#endif
+        for (int c = 0; c < components; c++)
+        {
+            float sum = 0.0f;
+            for (int t = 0; t < taps.taps; t++)
+                sum += weights[t] * source[sources[t] * components + c];
+            target[x * components + c] = sum;
+        }
+    }
+}
+
+float alphaCoverage(const float *pixels, size_t texels, int components, float cutoff, float scale)
+{
+    size_t covered = 0;
+    for (size_t i = 0; i < texels; i++)
+        covered += pixels[i * components + 3] * scale >= cutoff;
+    return static_cast<float>(covered) / texels;
+}
+
+// Returns levels 1..n (the base level is the caller's) down to 1x1, each
+// tightly packed with `components` bytes per texel.
+std::vector<std::vector<unsigned char>> generateMipChain(const unsigned char *pixels, int width, int height,
+                                                         int components, const MipOptions &options)
+{
+    // Encoding to sRGB rounds exactly in sRGB space: thresholds[v] is the
+    // linear value halfway between codes v and v + 1. The table buckets are
+    // narrower than the closest two thresholds, so a bucket lookup plus one
+    // compare finds the code.
+    const int ENCODE_BUCKETS = 4096;
+    float toLinear[256], thresholds[256];
+    for (int v = 0; v < 256; v++)
+    {
+        toLinear[v] = srgbToLinear(v / 255.0f);
+        thresholds[v] = v < 255 ? srgbToLinear((v + 0.5f) / 255.0f) : 2.0f;
+    }
+    std::vector<unsigned char> encodeTable(ENCODE_BUCKETS + 1);
+    for (int b = 0, code = 0; b <= ENCODE_BUCKETS; b++)
+    {
+        while (thresholds[code] <= static_cast<float>(b) / ENCODE_BUCKETS)
+            code++;
+        encodeTable[b] = static_cast<unsigned char>(code);
+    }
+
+    int colorChannels = options.srgb && components >= 3 ? 3 : 0;
+    size_t texels = static_cast<size_t>(width) * height;
+    std::vector<float> level(texels * components + components);
+    for (size_t i = 0; i < texels; i++)
+    {
+        for (int c = 0; c < components; c++)
+        {
+            unsigned char value = pixels[i * components + c];
+            level[i * components + c] = c < colorChannels ? toLinear[value] : value * (1.0f / 255.0f);
+        }
+    }
+
+    bool preserveCoverage = options.alphaCutoff >= 0.0f && components == 4;
+    float baseCoverage = preserveCoverage ? alphaCoverage(level.data(), texels, components, options.alphaCutoff, 1.0f) : 0.0f;
+
+    size_t strips = std::max<unsigned int>(1, std::thread::hardware_concurrency());
+    std::vector<std::vector<unsigned char>> levels;
+    std::vector<float> columns, next;
+    while (width > 1 || height > 1)
+    {
+        int targetWidth = std::max(1, width / 2), targetHeight = std::max(1, height / 2);
+        MipTaps verticalTaps = buildMipTaps(height, targetHeight, options.filter);
+        MipTaps horizontalTaps = buildMipTaps(width, targetWidth, options.filter);
+        size_t rowFloats = static_cast<size_t>(width) * components;
+        size_t targetRowFloats = static_cast<size_t>(targetWidth) * components;
+
+        columns.resize(static_cast<size_t>(targetHeight) * rowFloats + components);
+        next.resize(static_cast<size_t>(targetHeight) * targetRowFloats + components);
+        size_t levelStrips = std::min<size_t>(strips, targetHeight);
+        runOnWorkers(levelStrips, [&](size_t strip) {
+            for (int y = static_cast<int>(strip * targetHeight / levelStrips); y < static_cast<int>((strip + 1) * targetHeight / levelStrips); y++)
+            {
+                filterMipColumn(level.data(), columns.data() + y * rowFloats, rowFloats,
+                                &verticalTaps.sources[static_cast<size_t>(y) * verticalTaps.taps],
+                                &verticalTaps.weights[static_cast<size_t>(y) * verticalTaps.taps], verticalTaps.taps);
+                filterMipRow(columns.data() + y * rowFloats, next.data() + y * targetRowFloats,
+                             targetWidth, components, horizontalTaps);
+            }
+        });
+
+        size_t targetTexels = static_cast<size_t>(targetWidth) * targetHeight;
+        float alphaScale = 1.0f;
+        if (preserveCoverage)
+        {
+            float low = 0.0f, high = 4.0f;
+            for (int iteration = 0; iteration < 16; iteration++)
+            {
+                float mid = 0.5f * (low + high);
+                if (alphaCoverage(next.data(), targetTexels, components, options.alphaCutoff, mid) < baseCoverage)
+                    low = mid;
+                else
+                    high = mid;
+            }
+            alphaScale = high;
+        }
+
+        std::vector<unsigned char> encoded(targetTexels * components);
+        for (size_t i = 0; i < targetTexels; i++)
+        {
+            for (int c = 0; c < components; c++)
+            {
+                float value = std::min(1.0f, std::max(0.0f, next[i * components + c]));
+                if (c < colorChannels)
+                {
+                    int code = encodeTable[static_cast<int>(value * ENCODE_BUCKETS)];
+                    encoded[i * components + c] = static_cast<unsigned char>(code + (value >= thresholds[code]));
+                }
+                else
+                {
+                    if (c == 3 && preserveCoverage)
+                        value = std::min(1.0f, value * alphaScale);
+                    encoded[i * components + c] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+                }
+            }
+        }
+        levels.push_back(std::move(encoded));
+
+        level.swap(next);
+        width = targetWidth;
+        height = targetHeight;
+    }
+    return levels;
+}
+
+// Block-compressed textures. Colour images are encoded to BC1 (opaque) or
+// BC3 (with alpha), or to BC7 when preferred; two-channel images to BC5 and
+// single-channel ones to BC4. The full mip chain is stored precompressed in
+// a .texcache next to the source image and validated like a .meshcache.
+enum class TextureCodec : uint32_t {
+    BC1 = 1,
+    BC3 = 2,
+    BC4 = 3,
+    BC5 = 4,
+    BC7 = 5
+};
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+const char TEXTURE_CACHE_MAGIC[4] = {'T', 'E', 'X', 'C'};
+const uint32_t TEXTURE_CACHE_VERSION = 2;
+
+// TextureCacheHeader::flags: the encoder and mip settings the blocks were
+// built with.
+const uint32_t TEXTURE_CACHE_PREFER_BC7 = 1;
+const uint32_t TEXTURE_CACHE_MIP_FILTER_SHIFT = 1;
+const uint32_t TEXTURE_CACHE_MIP_SRGB = 8;
+const uint32_t TEXTURE_CACHE_MIP_COVERAGE = 16;
+
+struct TextureCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    uint32_t flags;
+    uint32_t codec;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t reserved;
+    uint64_t contentHash;
+};
+
+// levelOffsets are relative to the start of the level data in the cache
+// file; `data` holds levels firstLevel onwards. cachePath names the cache the
+// missing finer levels can be read back from, if it was written.
+struct CompressedTexture {
+    TextureCodec codec = TextureCodec::BC1;
+    int width = 0, height = 0;
+    std::vector<size_t> levelOffsets;
+    size_t firstLevel = 0;
+    std::vector<unsigned char> data;
+    std::string cachePath;
+};
+
+// Set with --uncompressed-textures, or at startup when the context lacks
+// S3TC and BPTC support.
+bool compressTextures = true;
+
+// Set with --bc7 to encode colour textures as BC7 (1 byte per texel) rather
+// than BC1/BC3, or when S3TC is unavailable.
+bool preferBC7 = false;
+
+// Set with --no-texture-streaming to keep every level of a compressed
+// texture resident from the start.
+bool textureStreaming = true;
+
+// Levels no larger than this on either side (the mip tail) are uploaded with
+// the texture and stay resident; finer ones are streamed in on demand.
+const int STREAMING_TAIL_SIZE = 128;
+
+size_t streamingTailLevel(int width, int height, size_t levelCount)
+{
+    size_t level = 0;
+    while (level + 1 < levelCount && std::max(width >> level, height >> level) > STREAMING_TAIL_SIZE)
+        level++;
+    return level;
+}
+
+uint32_t textureCacheFlags()
+{
+    uint32_t flags = static_cast<uint32_t>(mipOptions.filter) << TEXTURE_CACHE_MIP_FILTER_SHIFT;
+    if (preferBC7)
+        flags |= TEXTURE_CACHE_PREFER_BC7;
+    if (mipOptions.srgb)
+        flags |= TEXTURE_CACHE_MIP_SRGB;
+    if (mipOptions.alphaCutoff >= 0.0f)
+        flags |= TEXTURE_CACHE_MIP_COVERAGE;
+    return flags;
+}
+
+size_t textureBlockBytes(TextureCodec codec)
+{
+    return codec == TextureCodec::BC1 || codec == TextureCodec::BC4 ? 8 : 16;
+}
+
+size_t compressedLevelSize(TextureCodec codec, int width, int height)
+{
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * textureBlockBytes(codec);
+}
+
+GLenum textureCodecFormat(TextureCodec codec)
+{
+    switch (codec)
+    {
+    case TextureCodec::BC1:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TextureCodec::BC3:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TextureCodec::BC4:
+        return GL_COMPRESSED_RED_RGTC1;
+    case TextureCodec::BC5:
+        return GL_COMPRESSED_RG_RGTC2;
+    default:
+        return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+}
+
+const char *textureCodecName(TextureCodec codec)
+{
+    const char *names[] = {"?", "BC1", "BC3", "BC4", "BC5", "BC7"};
+    return names[static_cast<uint32_t>(codec)];
+}
+
+TextureCodec chooseTextureCodec(const unsigned char *pixels, int width, int height, int components)
+{
+    if (components == 1)
+        return TextureCodec::BC4;
+    if (components == 2)
+        return TextureCodec::BC5;
+    if (preferBC7)
+        return TextureCodec::BC7;
+    if (components == 4)
+    {
+        size_t texels = static_cast<size_t>(width) * height;
+        for (size_t i = 0; i < texels; i++)
+        {
+            if (pixels[i * 4 + 3] != 255)
+                return TextureCodec::BC3;
+        }
+    }
+    return TextureCodec::BC1;
+}
+
+// Gathers the 4x4 block at (blockX, blockY) as RGBA, clamping at the image
+// edge. Missing channels read as they would from an uncompressed texture.
+void fetchBlock(const unsigned char *pixels, int width, int height, int components,
+                int blockX, int blockY, unsigned char block[16][4])
+{
+    for (int y = 0; y < 4; y++)
+    {
+        int sourceY = std::min(blockY * 4 + y, height - 1);
+        for (int x = 0; x < 4; x++)
+        {
+            int sourceX = std::min(blockX * 4 + x, width - 1);
+            const unsigned char *source = pixels + (static_cast<size_t>(sourceY) * width + sourceX) * components;
+            unsigned char *texel = block[y * 4 + x];
+            texel[0] = source[0];
+            texel[1] = components >= 2 ? source[1] : 0;
+            texel[2] = components >= 3 ? source[2] : 0;
+            texel[3] = components == 4 ? source[3] : 255;
+        }
+    }
+}
+
+// Principal axis of a block's texels (power iteration on the covariance),
+// used to pick endpoints along the direction the colours actually vary in.
+template <int N>
+glm::vec<N, float> principalAxis(const unsigned char block[16][4], glm::vec<N, float> &mean)
+{
+    mean = glm::vec<N, float>(0.0f);
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < N; c++)
+            mean[c] += block[i][c] / 16.0f;
+
+    glm::mat<N, N, float> covariance(0.0f);
+    for (int i = 0; i < 16; i++)
+    {
+        glm::vec<N, float> d;
+        for (int c = 0; c < N; c++)
+            d[c] = block[i][c] - mean[c];
+        covariance += glm::outerProduct(d, d);
+    }
+
+    glm::vec<N, float> axis(1.0f);
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        axis = covariance * axis;
+        float length = glm::length(axis);
+        if (length < 1e-6f)
+            return glm::vec<N, float>(0.0f);
+        axis /= length;
+    }
+    return axis;
+}
+
+uint16_t packRGB565(glm::vec3 color)
+{
+    glm::vec3 c = glm::clamp(color, 0.0f, 255.0f);
+    return static_cast<uint16_t>((std::lround(c.r * 31.0f / 255.0f) << 11) |
+                                 (std::lround(c.g * 63.0f / 255.0f) << 5) |
+                                 std::lround(c.b * 31.0f / 255.0f));
+}
+
+glm::vec3 unpackRGB565(uint16_t packed)
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+void encodeBC1Block(const unsigned char block[16][4], unsigned char *out)
+{
+    glm::vec3 mean;
+    glm::vec3 axis = principalAxis<3>(block, mean);
+    float minT = 0.0f, maxT = 0.0f;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = glm::dot(glm::vec3(block[i][0], block[i][1], block[i][2]) - mean, axis);
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    // Inset the endpoints so the interpolated colours land on the texels
+    // rather than the endpoints sitting on the outliers.
+    float inset = (maxT - minT) / 16.0f;
+    uint16_t color0 = packRGB565(mean + axis * (maxT - inset));
+    uint16_t color1 = packRGB565(mean + axis * (minT + inset));
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    glm::vec3 palette[4];
+    palette[0] = unpackRGB565(color0);
+    palette[1] = unpackRGB565(color1);
+    palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+    palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+    uint32_t indices = 0;
+    if (color0 != color1)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            glm::vec3 texel(block[i][0], block[i][1], block[i][2]);
+            int best = 0;
+            float bestError = FLT_MAX;
+            for (int p = 0; p < 4; p++)
+            {
+                glm::vec3 d = texel - palette[p];
+                float error = glm::dot(d, d);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= static_cast<uint32_t>(best) << (i * 2);
+        }
+    }
+
+    out[0] = color0 & 0xff;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xff;
+    out[3] = color1 >> 8;
+    memcpy(out + 4, &indices, 4);
+}
+
+// One channel of the block in the 8-value BC4 mode.
+void encodeBC4Block(const unsigned char block[16][4], int channel, unsigned char *out)
+{
+    int minValue = 255, maxValue = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        minValue = std::min<int>(minValue, block[i][channel]);
+        maxValue = std::max<int>(maxValue, block[i][channel]);
+    }
+
+    uint64_t bits = static_cast<uint64_t>(maxValue) | static_cast<uint64_t>(minValue) << 8;
+    if (maxValue > minValue)
+    {
+        float palette[8];
+        palette[0] = static_cast<float>(maxValue);
+        palette[1] = static_cast<float>(minValue);
+        for (int p = 2; p < 8; p++)
+            palette[p] = ((8 - p) * maxValue + (p - 1) * minValue) / 7.0f;
+
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            float bestError = FLT_MAX;
+            for (int p = 0; p < 8; p++)
+            {
+                float error = std::fabs(block[i][channel] - palette[p]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            bits |= static_cast<uint64_t>(best) << (16 + i * 3);
+        }
+    }
+    for (int b = 0; b < 8; b++)
+        out[b] = static_cast<unsigned char>(bits >> (b * 8));
+}
+
+void putBits(unsigned char *out, int &position, uint32_t value, int count)
+{
+    for (int b = 0; b < count; b++, position++)
+    {
+        if (value >> b & 1)
+            out[position >> 3] |= static_cast<unsigned char>(1 << (position & 7));
+    }
+}
+
+// BC7 mode 6 only: one subset, RGBA endpoints of 7 bits plus a p-bit each,
+// and 4-bit indices. It is the mode that suits smooth photographic blocks,
+// which is what the scene's textures are.
+void encodeBC7Block(const unsigned char block[16][4], unsigned char *out)
+{
+    static const int WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    glm::vec4 mean;
+    glm::vec4 axis = principalAxis<4>(block, mean);
+    float minT = 0.0f, maxT = 0.0f;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = glm::dot(glm::vec4(block[i][0], block[i][1], block[i][2], block[i][3]) - mean, axis);
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    glm::vec4 ends[2] = {mean + axis * minT, mean + axis * maxT};
+
+    // Quantize each endpoint with whichever p-bit reproduces it better.
+    int quantized[2][4], pbits[2];
+    glm::vec4 endpoints[2];
+    for (int e = 0; e < 2; e++)
+    {
+        float bestError = FLT_MAX;
+        for (int p = 0; p < 2; p++)
+        {
+            int q[4];
+            glm::vec4 value;
+            for (int c = 0; c < 4; c++)
+            {
+                q[c] = std::min(127, std::max(0, static_cast<int>(std::lround((ends[e][c] - p) / 2.0f))));
+                value[c] = static_cast<float>(q[c] << 1 | p);
+            }
+            glm::vec4 d = value - glm::clamp(ends[e], 0.0f, 255.0f);
+            float error = glm::dot(d, d);
+            if (error < bestError)
+            {
+                bestError = error;
+                pbits[e] = p;
+                memcpy(quantized[e], q, sizeof(q));
+                endpoints[e] = value;
+            }
+        }
+    }
+
+    glm::vec4 palette[16];
+    for (int p = 0; p < 16; p++)
+    {
+        for (int c = 0; c < 4; c++)
+            palette[p][c] = static_cast<float>(((64 - WEIGHTS[p]) * static_cast<int>(endpoints[0][c]) +
+                                                WEIGHTS[p] * static_cast<int>(endpoints[1][c]) + 32) >> 6);
+    }
+
+    int indices[16];
+    for (int i = 0; i < 16; i++)
+    {
+        glm::vec4 texel(block[i][0], block[i][1], block[i][2], block[i][3]);
+        float bestError = FLT_MAX;
+        for (int p = 0; p < 16; p++)
+        {
+            glm::vec4 d = texel - palette[p];
+            float error = glm::dot(d, d);
+            if (error < bestError)
+            {
+                bestError = error;
+                indices[i] = p;
+            }
+        }
+    }
+
+    // The first texel's index is stored without its top bit, so it must be
+    // below 8; swapping the endpoints mirrors every index.
+    if (indices[0] >= 8)
+    {
+        std::swap(quantized[0], quantized[1]);
+        std::swap(pbits[0], pbits[1]);
+        for (int i = 0; i < 16; i++)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(out, 0, 16);
+    int position = 0;
+    putBits(out, position, 1 << 6, 7);
+    for (int c = 0; c < 4; c++)
+    {
+        putBits(out, position, quantized[0][c], 7);
+        putBits(out, position, quantized[1][c], 7);
+    }
+    putBits(out, position, pbits[0], 1);
+    putBits(out, position, pbits[1], 1);
+    putBits(out, position, indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        putBits(out, position, indices[i], 4);
+}
+
+void encodeTextureBlock(TextureCodec codec, const unsigned char block[16][4], unsigned char *out)
+{
+    switch (codec)
+    {
+    case TextureCodec::BC1:
+        encodeBC1Block(block, out);
+        break;
+    case TextureCodec::BC3:
+        encodeBC4Block(block, 3, out);
+        encodeBC1Block(block, out + 8);
+        break;
+    case TextureCodec::BC4:
+        encodeBC4Block(block, 0, out);
+        break;
+    case TextureCodec::BC5:
+        encodeBC4Block(block, 0, out);
+        encodeBC4Block(block, 1, out + 8);
+        break;
+    case TextureCodec::BC7:
+        encodeBC7Block(block, out);
+        break;
+    }
+}
+
+// Encodes the image and its mip chain (from generateMipChain), each level
+// split into strips of block rows across all cores.
+CompressedTexture compressTexture(const unsigned char *pixels, int width, int height, int components)
+{
+    CompressedTexture texture;
+    texture.codec = chooseTextureCodec(pixels, width, height, components);
+    texture.width = width;
+    texture.height = height;
+
+    size_t total = 0;
+    for (int levelWidth = width, levelHeight = height;; levelWidth = std::max(1, levelWidth / 2),
+             levelHeight = std::max(1, levelHeight / 2))
+    {
+        texture.levelOffsets.push_back(total);
+        total += compressedLevelSize(texture.codec, levelWidth, levelHeight);
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+    }
+    texture.data.resize(total);
+
+    std::vector<std::vector<unsigned char>> mips = generateMipChain(pixels, width, height, components, mipOptions);
+    const unsigned char *level = pixels;
+    int levelWidth = width, levelHeight = height;
+    for (size_t l = 0; l < texture.levelOffsets.size(); l++)
+    {
+        if (l > 0)
+        {
+            level = mips[l - 1].data();
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+
+        int blocksWide = (levelWidth + 3) / 4, blocksHigh = (levelHeight + 3) / 4;
+        size_t strips = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), blocksHigh));
+        unsigned char *out = texture.data.data() + texture.levelOffsets[l];
+        size_t blockBytes = textureBlockBytes(texture.codec);
+        TextureCodec codec = texture.codec;
+        runOnWorkers(strips, [&](size_t strip) {
+            unsigned char block[16][4];
+            for (int by = static_cast<int>(strip * blocksHigh / strips); by < static_cast<int>((strip + 1) * blocksHigh / strips); by++)
+            {
+                for (int bx = 0; bx < blocksWide; bx++)
+                {
+                    fetchBlock(level, levelWidth, levelHeight, components, bx, by, block);
+                    encodeTextureBlock(codec, block, out + (static_cast<size_t>(by) * blocksWide + bx) * blockBytes);
+                }
+            }
+        });
+    }
+    return texture;
+}
+
+// With tailOnly, only the mip tail is read; the finer levels stay on disk.
+bool openTextureCache(const std::string &cachePath, const char *sourcePath, uint32_t flags, CompressedTexture &texture,
+                      bool tailOnly)
+{
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    if (!getSourceStamp(sourcePath, sourceSize, sourceModified))
+        return false;
+    MappedFile mapped;
+    if (!mapFile(cachePath.c_str(), mapped))
+        return false;
+
+    const TextureCacheHeader *header = reinterpret_cast<const TextureCacheHeader *>(mapped.data);
+    bool valid = mapped.size >= sizeof(TextureCacheHeader) &&
+                 memcmp(header->magic, TEXTURE_CACHE_MAGIC, sizeof(TEXTURE_CACHE_MAGIC)) == 0 &&
+                 header->version == TEXTURE_CACHE_VERSION &&
+                 header->flags == flags &&
+                 header->sourceSize == sourceSize &&
+                 header->sourceModified == sourceModified &&
+                 header->levelCount > 0 &&
+                 header->codec >= static_cast<uint32_t>(TextureCodec::BC1) &&
+                 header->codec <= static_cast<uint32_t>(TextureCodec::BC7);
+    if (valid)
+    {
+        texture.codec = static_cast<TextureCodec>(header->codec);
+        texture.width = static_cast<int>(header->width);
+        texture.height = static_cast<int>(header->height);
+        texture.levelOffsets.clear();
+        size_t total = 0;
+        int levelWidth = texture.width, levelHeight = texture.height;
+        for (uint32_t l = 0; l < header->levelCount; l++)
+        {
+            texture.levelOffsets.push_back(total);
+            total += compressedLevelSize(texture.codec, levelWidth, levelHeight);
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+        valid = mapped.size == sizeof(TextureCacheHeader) + total;
+        if (valid)
+        {
+            texture.firstLevel = tailOnly ? streamingTailLevel(texture.width, texture.height, header->levelCount) : 0;
+            texture.data.assign(mapped.data + sizeof(TextureCacheHeader) + texture.levelOffsets[texture.firstLevel],
+                                mapped.data + mapped.size);
+            texture.cachePath = cachePath;
+        }
+    }
+    unmapFile(mapped);
+    return valid;
+}
+
+bool writeTextureCache(const std::string &cachePath, const char *sourcePath, uint32_t flags,
+                       const CompressedTexture &texture)
+{
+    TextureCacheHeader header = {};
+    memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(TEXTURE_CACHE_MAGIC));
+    header.version = TEXTURE_CACHE_VERSION;
+    if (!getSourceStamp(sourcePath, header.sourceSize, header.sourceModified))
+        return false;
+    uint64_t sourceSize;
+    if (!hashFileContents(sourcePath, header.contentHash, sourceSize))
+        return false;
+    header.flags = flags;
+    header.codec = static_cast<uint32_t>(texture.codec);
+    header.width = static_cast<uint32_t>(texture.width);
+    header.height = static_cast<uint32_t>(texture.height);
+    header.levelCount = static_cast<uint32_t>(texture.levelOffsets.size());
+
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(texture.data.data()), texture.data.size());
+        if (!out)
+        {
+            std::cerr << "Failed to write texture cache: " << cachePath << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec)
+    {
+        std::cerr << "Failed to write texture cache: " << cachePath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// The CPU half of a compressed texture load: the cached blocks if current,
+// otherwise the image decoded, encoded and written back to the cache. When
+// streaming, only the mip tail is kept once the cache is on disk.
+bool loadCompressedTexture(const char *path, CompressedTexture &texture)
+{
+    std::string cachePath = std::string(path) + ".texcache";
+    uint32_t cacheFlags = textureCacheFlags();
+    if (openTextureCache(cachePath, path, cacheFlags, texture, textureStreaming))
+        return true;
+
+    int width, height, components;
+    unsigned char *pixels = stbi_load(path, &width, &height, &components, 0);
+    if (!pixels)
+        return false;
+    auto start = std::chrono::steady_clock::now();
+    texture = compressTexture(pixels, width, height, components);
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stbi_image_free(pixels);
+
+    std::cout << "Compressed " << path << ": " << width << "x" << height << " to " << textureCodecName(texture.codec)
+              << ", " << texture.levelOffsets.size() << " levels, "
+              << static_cast<size_t>(width) * height * components * 4 / 3 / 1024 << " KB -> "
+              << texture.data.size() / 1024 << " KB in " << elapsed << " ms" << std::endl;
+    if (writeTextureCache(cachePath, path, cacheFlags, texture))
+    {
+        texture.cachePath = cachePath;
+        if (textureStreaming)
+        {
+            texture.firstLevel = streamingTailLevel(texture.width, texture.height, texture.levelOffsets.size());
+            texture.data.erase(texture.data.begin(), texture.data.begin() + texture.levelOffsets[texture.firstLevel]);
+        }
+    }
+    return true;
+}
+
+size_t compressedLevelBytes(const CompressedTexture &texture, size_t level)
+{
+    return compressedLevelSize(texture.codec, std::max(1, texture.width >> level), std::max(1, texture.height >> level));
+}
+
+// Uploads one level of a compressed texture to the bound GL_TEXTURE_2D.
+void uploadCompressedLevel(const CompressedTexture &texture, size_t level)
+{
+    int width = std::max(1, texture.width >> level), height = std::max(1, texture.height >> level);
+    glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), textureCodecFormat(texture.codec), width, height, 0,
+                           static_cast<GLsizei>(compressedLevelBytes(texture, level)),
+                           texture.data.data() + texture.levelOffsets[level] - texture.levelOffsets[texture.firstLevel]);
+}
+
+// Restricts sampling of the bound texture to the levels uploaded so far.
+void setCompressedLevelRange(const CompressedTexture &texture)
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(texture.firstLevel));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(texture.levelOffsets.size() - 1));
+}
+
+// BC4/BC5 (RGTC) are core in GL 3.0; BC1/BC3 need S3TC and BC7 needs BPTC.
+void detectTextureCompression()
+{
+    bool s3tc = glfwExtensionSupported("GL_EXT_texture_compression_s3tc");
+    bool bptc = glfwExtensionSupported("GL_ARB_texture_compression_bptc");
+    if (!s3tc && !bptc)
+    {
+        if (compressTextures)
+            std::cerr << "No S3TC or BPTC support, textures stay uncompressed" << std::endl;
+        compressTextures = false;
+    }
+    else if (!s3tc)
+        preferBC7 = true;
+    else if (!bptc)
+    {
+        if (compressTextures && preferBC7)
+            std::cerr << "No BPTC support, --bc7 ignored and textures use BC1/BC3" << std::endl;
+        preferBC7 = false;
+    }
+}
+
+// Repeat wrapping and trilinear filtering for a bound, mipmapped texture.
+void setTextureSampling()
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+GLenum textureFormat(int components)
+{
+    if (components == 1)
+        return GL_RED;
+    if (components == 2)
+        return GL_RG;
+    if (components == 3)
+        return GL_RGB;
+    return GL_RGBA;
+}
+
+// Uploads precomputed levels 1..n to the bound texture.
+void uploadMipLevels(const std::vector<std::vector<unsigned char>> &levels, int width, int height, int components)
+{
+    GLenum format = textureFormat(components);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t l = 0; l < levels.size(); l++)
+    {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(l + 1), format, width, height, 0, format, GL_UNSIGNED_BYTE, levels[l].data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Residency of a compressed texture whose levels above the mip tail are
+// streamed from its cache. Levels baseLevel onwards are resident and
+// pendingLevel (baseLevel - 1, or -1) is on its way in. desiredLevel is the
+// finest level any draw asked for this frame; finestLevel is raised past a
+// level that could not be read. minLod fades a newly arrived level in.
+struct StreamedTexture {
+    std::string cachePath;
+    TextureCodec codec = TextureCodec::BC1;
+    int width = 0, height = 0;
+    std::vector<size_t> levelOffsets;
+    int tailLevel = 0;
+    int finestLevel = 0;
+    int baseLevel = 0;
+    int pendingLevel = -1;
+    int desiredLevel = 0;
+    float minLod = 0.0f;
+    bool orphaned = false;
+};
+
+// Keyed by GL texture name. A texture released while a level is in flight is
+// kept (orphaned) until the level arrives, so its name cannot be reused by a
+// new texture the level would then land in.
+struct TextureStreamer {
+    std::unordered_map<unsigned int, StreamedTexture> textures;
+    size_t residentBytes = 0;
+    size_t budgetBytes = size_t(256) * 1024 * 1024;
+    glm::vec3 viewPosition = glm::vec3(0.0f);
+    float pixelsPerUnit = 1.0f;
+    size_t levelsStreamed = 0;
+    size_t levelsEvicted = 0;
+};
+
+// residentBytes counts levels in flight, so requests never overshoot the
+// budget, which is set with --texture-budget-mb. pixelsPerUnit is the
+// projected size in pixels of one unit seen at distance one.
+TextureStreamer textureStreamer;
+
+size_t streamedLevelBytes(const StreamedTexture &streamed, int level)
+{
+    return compressedLevelSize(streamed.codec, std::max(1, streamed.width >> level), std::max(1, streamed.height >> level));
+}
+
+// Starts managing a texture uploaded from its mip tail.
+void registerStreamedTexture(unsigned int texture, const CompressedTexture &compressed)
+{
+    StreamedTexture &streamed = textureStreamer.textures[texture];
+    streamed.cachePath = compressed.cachePath;
+    streamed.codec = compressed.codec;
+    streamed.width = compressed.width;
+    streamed.height = compressed.height;
+    streamed.levelOffsets = compressed.levelOffsets;
+    streamed.tailLevel = static_cast<int>(compressed.firstLevel);
+    streamed.baseLevel = streamed.tailLevel;
+    streamed.desiredLevel = streamed.tailLevel;
+    for (size_t level = compressed.firstLevel; level < compressed.levelOffsets.size(); level++)
+        textureStreamer.residentBytes += compressedLevelBytes(compressed, level);
+}
+
+// Records the level a draw needs, assuming the texture spans the mesh once:
+// one texel per pixel of the bounding sphere's projected diameter, measured
+// at the sphere's nearest point.
+void requestTextureDetail(unsigned int texture, const Model &mesh, const glm::mat4 &model)
+{
+    auto entry = textureStreamer.textures.find(texture);
+    if (entry == textureStreamer.textures.end())
+        return;
+    StreamedTexture &streamed = entry->second;
+
+    glm::vec3 center = glm::vec3(model * glm::vec4(0.5f * (mesh.boundsMin + mesh.boundsMax), 1.0f));
+    float scale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])),
+                            glm::length(glm::vec3(model[2]))});
+    float radius = 0.5f * glm::length(mesh.boundsMax - mesh.boundsMin) * scale;
+    float distance = std::max(glm::distance(center, textureStreamer.viewPosition) - radius, 1e-3f);
+    float projected = 2.0f * radius * textureStreamer.pixelsPerUnit / distance;
+
+    int level = streamed.tailLevel;
+    if (projected > 0.0f)
+    {
+        float texels = static_cast<float>(std::max(streamed.width, streamed.height));
+        level = std::min(level, std::max(0, static_cast<int>(std::floor(std::log2(texels / projected)))));
+    }
+    streamed.desiredLevel = std::min(streamed.desiredLevel, level);
+}
+
+bool readFileRange(const std::string &path, size_t offset, size_t size, std::vector<unsigned char> &bytes)
+{
+    std::ifstream in(path, std::ios::binary);
+    bytes.resize(size);
+    in.seekg(static_cast<std::streamoff>(offset));
+    in.read(reinterpret_cast<char *>(bytes.data()), static_cast<std::streamsize>(size));
+    if (!in)
+    {
+        std::cerr << "Failed to read " << size << " bytes at " << offset << " from " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+unsigned int loadTexture(const char *path)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    CompressedTexture compressed;
+    if (compressTextures && loadCompressedTexture(path, compressed))
+    {
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        for (size_t level = compressed.firstLevel; level < compressed.levelOffsets.size(); level++)
+            uploadCompressedLevel(compressed, level);
+        setCompressedLevelRange(compressed);
+        setTextureSampling();
+        if (compressed.firstLevel > 0)
+            registerStreamedTexture(textureID, compressed);
+        return textureID;
+    }
+
+    int width, height, nrComponents;
+    unsigned char *data = loadTextureImage(path, width, height, nrComponents);
+    if (data)
+    {
+        GLenum format = textureFormat(nrComponents);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        if (generateMipsOnCpu)
+            uploadMipLevels(generateMipChain(data, width, height, nrComponents, mipOptions), width, height, nrComponents);
+        else
+            glGenerateMipmap(GL_TEXTURE_2D);
+
+        setTextureSampling();
+
+        stbi_image_free(data);
+    }
+    else
+    {
+        std::cerr << "Texture failed to load at path: " << path << std::endl;
+        stbi_image_free(data);
+    }
+
+    return textureID;
+}
+
+// Meshes and textures are shared between Renderables through handles into an
+// AssetPool. Each slot is keyed by every path it was requested under and by
+// a hash of its file contents, so copies of the same file are loaded once.
+// A slot's generation is bumped when its asset is destroyed; a handle that
+// outlives its asset then resolves to null instead of to the slot's next
+// occupant.
+template <typename T>
+struct AssetHandle {
+    uint32_t index = 0;
+    uint32_t generation = 0;
+};
+
+const uint32_t NO_ASSET_SLOT = 0xffffffffu;
+
+template <typename T>
+struct AssetPool {
+    struct Slot {
+        T asset = T();
+        uint32_t generation = 1;
+        uint32_t refCount = 0;
+        // False while asset is a placeholder copy; only loaded assets are
+        // destroyed on release.
+        bool loaded = false;
+        // Set when an async load turned out to duplicate another slot's
+        // content: asset is a copy of that slot's, which this one retains.
+        uint32_t aliasOf = NO_ASSET_SLOT;
+        std::vector<std::string> paths;
+        bool hashed = false;
+        uint64_t contentHash = 0;
+        uint64_t contentSize = 0;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<std::string, uint32_t> byPath;
+    std::unordered_map<uint64_t, uint32_t> byContent;
+    size_t loads = 0, pathHits = 0, contentHits = 0;
+    // Bumped whenever a slot's asset changes (placed, loaded, released), so
+    // data copied out of assets knows to re-read.
+    uint64_t assetVersion = 0;
+};
+
+using MeshHandle = AssetHandle<Model>;
+using TextureHandle = AssetHandle<unsigned int>;
+
+struct AssetRegistry {
+    AssetPool<Model> meshes;
+    AssetPool<unsigned int> textures;
+};
+
+AssetRegistry assets;
+
+// virtualTexture indexes virtualTextures.textures when the texture is
+// sampled through the virtual texture cache instead of `texture`.
+struct Renderable {
+    MeshHandle mesh;
+    TextureHandle texture;
+    int virtualTexture = -1;
+};
+
+template <typename T>
+T *resolveAsset(AssetPool<T> &pool, AssetHandle<T> handle)
+{
+    if (handle.index >= pool.slots.size() || pool.slots[handle.index].generation != handle.generation)
+        return nullptr;
+    return &pool.slots[handle.index].asset;
+}
+
+// Like resolveAsset, but nullptr while the slot still holds the loader's
+// placeholder.
+template <typename T>
+T *resolveLoadedAsset(AssetPool<T> &pool, AssetHandle<T> handle)
+{
+    T *asset = resolveAsset(pool, handle);
+    if (!asset)
+        return nullptr;
+    const typename AssetPool<T>::Slot &slot = pool.slots[handle.index];
+    return slot.loaded || slot.aliasOf != NO_ASSET_SLOT ? asset : nullptr;
+}
+
+template <typename T>
+AssetHandle<T> retainAsset(AssetPool<T> &pool, uint32_t index)
+{
+    pool.slots[index].refCount++;
+    AssetHandle<T> handle;
+    handle.index = index;
+    handle.generation = pool.slots[index].generation;
+    return handle;
+}
+
+std::string assetKey(const char *path)
+{
+    return std::filesystem::path(path).lexically_normal().generic_string();
+}
+
+// Content identity of an asset's source. A current cache header carries
+// it, so only a cold or stale load hashes the source itself.
+bool meshContentHash(const char *path, uint64_t &hash, uint64_t &size)
+{
+    return readCachedContentHash<MeshCacheHeader>(std::string(path) + ".meshcache", path, MESH_CACHE_MAGIC,
+                                                  MESH_CACHE_VERSION, hash, size) ||
+           hashFileContents(path, hash, size);
+}
+
+bool textureContentHash(const char *path, uint64_t &hash, uint64_t &size)
+{
+    if (compressTextures &&
+        readCachedContentHash<TextureCacheHeader>(std::string(path) + ".texcache", path, TEXTURE_CACHE_MAGIC,
+                                                  TEXTURE_CACHE_VERSION, hash, size))
+        return true;
+    return hashFileContents(path, hash, size);
+}
+
+// Returns the slot holding content identical to (hash, size), if any.
+template <typename T>
+uint32_t findAssetContent(const AssetPool<T> &pool, uint64_t hash, uint64_t size)
+{
+    auto contentEntry = pool.byContent.find(hash);
+    if (contentEntry == pool.byContent.end() || pool.slots[contentEntry->second].contentSize != size)
+        return NO_ASSET_SLOT;
+    return contentEntry->second;
+}
+
+template <typename T>
+uint32_t allocateAssetSlot(AssetPool<T> &pool, const std::string &key)
+{
+    uint32_t index;
+    if (!pool.freeSlots.empty())
+    {
+        index = pool.freeSlots.back();
+        pool.freeSlots.pop_back();
+    }
+    else
+    {
+        index = static_cast<uint32_t>(pool.slots.size());
+        pool.slots.emplace_back();
+    }
+    pool.slots[index].paths.assign(1, key);
+    pool.byPath[key] = index;
+    pool.loads++;
+    pool.assetVersion++;
+    return index;
+}
+
+template <typename T>
+void setAssetContent(AssetPool<T> &pool, uint32_t index, bool hashed, uint64_t hash, uint64_t size)
+{
+    typename AssetPool<T>::Slot &slot = pool.slots[index];
+    slot.hashed = hashed;
+    slot.contentHash = hash;
+    slot.contentSize = size;
+    if (hashed)
+        pool.byContent[hash] = index;
+}
+
+template <typename T>
+AssetHandle<T> acquireAsset(AssetPool<T> &pool, const char *path, T (*load)(const char *),
+                            bool (*contentHash)(const char *, uint64_t &, uint64_t &))
+{
+    std::string key = assetKey(path);
+    auto pathEntry = pool.byPath.find(key);
+    if (pathEntry != pool.byPath.end())
+    {
+        pool.pathHits++;
+        return retainAsset(pool, pathEntry->second);
+    }
+
+    uint64_t hash = 0, size = 0;
+    bool hashed = contentHash(path, hash, size);
+    uint32_t existing = hashed ? findAssetContent(pool, hash, size) : NO_ASSET_SLOT;
+    if (existing != NO_ASSET_SLOT)
+    {
+        std::cout << "Sharing " << path << " with identical " << pool.slots[existing].paths.front() << std::endl;
+        pool.contentHits++;
+        pool.byPath[key] = existing;
+        pool.slots[existing].paths.push_back(key);
+        return retainAsset(pool, existing);
+    }
+
+    uint32_t index = allocateAssetSlot(pool, key);
+    pool.slots[index].asset = load(path);
+    pool.slots[index].loaded = true;
+    pool.assetVersion++;
+    setAssetContent(pool, index, hashed, hash, size);
+    return retainAsset(pool, index);
+}
+
+template <typename T>
+void releaseAsset(AssetPool<T> &pool, AssetHandle<T> handle, void (*destroy)(T &))
+{
+    if (!resolveAsset(pool, handle))
+        return;
+    typename AssetPool<T>::Slot &slot = pool.slots[handle.index];
+    if (--slot.refCount > 0)
+        return;
+
+    if (slot.loaded)
+        destroy(slot.asset);
+    for (const std::string &path : slot.paths)
+        pool.byPath.erase(path);
+    if (slot.hashed)
+    {
+        auto contentEntry = pool.byContent.find(slot.contentHash);
+        if (contentEntry != pool.byContent.end() && contentEntry->second == handle.index)
+            pool.byContent.erase(contentEntry);
+    }
+    uint32_t aliasOf = slot.aliasOf;
+    slot.asset = T();
+    slot.paths.clear();
+    slot.loaded = false;
+    slot.aliasOf = NO_ASSET_SLOT;
+    slot.hashed = false;
+    slot.generation++;
+    pool.freeSlots.push_back(handle.index);
+    pool.assetVersion++;
+
+    if (aliasOf != NO_ASSET_SLOT)
+    {
+        AssetHandle<T> target;
+        target.index = aliasOf;
+        target.generation = pool.slots[aliasOf].generation;
+        releaseAsset(pool, target, destroy);
+    }
+}
+
+template <typename T>
+void reportAssetPool(const char *name, const AssetPool<T> &pool)
+{
+    std::cout << "Assets: " << pool.loads << " " << name << " loaded for "
+              << pool.loads + pool.pathHits + pool.contentHits << " requests ("
+              << pool.pathHits << " by path, " << pool.contentHits << " by content)" << std::endl;
+}
+
+void destroyModel(Model &model)
+{
+    glDeleteVertexArrays(1, &model.VAO);
+    glDeleteBuffers(1, &model.VBO);
+    glDeleteBuffers(1, &model.EBO);
+}
+
+void destroyTexture(unsigned int &texture)
+{
+    auto streamed = textureStreamer.textures.find(texture);
+    if (streamed != textureStreamer.textures.end())
+    {
+        if (streamed->second.pendingLevel >= 0)
+        {
+            streamed->second.orphaned = true;
+            return;
+        }
+        for (int level = streamed->second.baseLevel; level < static_cast<int>(streamed->second.levelOffsets.size()); level++)
+            textureStreamer.residentBytes -= streamedLevelBytes(streamed->second, level);
+        textureStreamer.textures.erase(streamed);
+    }
+    glDeleteTextures(1, &texture);
+}
+
+// Multi-producer single-consumer queue of heap nodes (Vyukov). Producers
+// publish with a single exchange and never wait on each other or on the
+// consumer; tail always points at the last consumed node.
+template <typename T>
+struct MpscQueue {
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        T value;
+    };
+
+    Node stub;
+    std::atomic<Node *> head{&stub};
+    Node *tail = &stub;
+
+    ~MpscQueue();
+};
+
+// Frees the last consumed node and any unconsumed ones, leaving the queue
+// empty. Only valid once no producer can push any more.
+template <typename T>
+void mpscReset(MpscQueue<T> &queue)
+{
+    typename MpscQueue<T>::Node *node = queue.tail;
+    while (node)
+    {
+        typename MpscQueue<T>::Node *next = node->next.load(std::memory_order_acquire);
+        if (node != &queue.stub)
+            delete node;
+        node = next;
+    }
+    queue.stub.next.store(nullptr, std::memory_order_relaxed);
+    queue.head.store(&queue.stub, std::memory_order_relaxed);
+    queue.tail = &queue.stub;
+}
+
+template <typename T>
+MpscQueue<T>::~MpscQueue()
+{
+    mpscReset(*this);
+}
+
+template <typename T>
+void mpscPush(MpscQueue<T> &queue, T value)
+{
+    typename MpscQueue<T>::Node *node = new typename MpscQueue<T>::Node();
+    node->value = std::move(value);
+    typename MpscQueue<T>::Node *previous = queue.head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+}
+
+// Consumer side only.
+template <typename T>
+bool mpscEmpty(const MpscQueue<T> &queue)
+{
+    return queue.tail->next.load(std::memory_order_acquire) == nullptr;
+}
+
+template <typename T>
+bool mpscPop(MpscQueue<T> &queue, T &value)
+{
+    typename MpscQueue<T>::Node *next = queue.tail->next.load(std::memory_order_acquire);
+    if (!next)
+        return false;
+    value = std::move(next->value);
+    if (queue.tail != &queue.stub)
+        delete queue.tail;
+    queue.tail = next;
+    return true;
+}
+
+enum class AssetKind {
+    Mesh,
+    Texture,
+    TextureLevel,
+    VirtualTile,
+    VirtualTextureCache
+};
+
+// One level of a streamed texture: where its blocks are in the texture
+// cache, and everything needed to upload them without the streamer's state.
+struct TextureLevelRequest {
+    unsigned int texture = 0;
+    int level = 0;
+    TextureCodec codec = TextureCodec::BC1;
+    int width = 0, height = 0;
+    size_t offset = 0, size = 0;
+};
+
+// TextureLevel jobs read `level` from the cache at `path` and carry no slot.
+// VirtualTile jobs read level.size bytes at level.offset, and carry the
+// virtual tile key in `index`. VirtualTextureCache jobs build the .vtcache
+// for the source at `path`, for the virtual texture `index`.
+struct AssetLoadJob {
+    AssetKind kind = AssetKind::Mesh;
+    uint32_t index = 0;
+    uint32_t generation = 0;
+    std::string path;
+    TextureLevelRequest level;
+};
+
+// Decoded on a worker, then uploaded by the GL thread a budgeted number of
+// bytes at a time; the progress fields are only touched by the GL thread.
+struct AssetUpload {
+    AssetLoadJob job;
+    bool failed = false;
+    bool hashed = false;
+    uint64_t contentHash = 0;
+    uint64_t contentSize = 0;
+
+    PreparedMesh mesh;
+    size_t vertexBytesUploaded = 0;
+    size_t indexBytesUploaded = 0;
+
+    unsigned char *pixels = nullptr;
+    int width = 0, height = 0, components = 0;
+    int rowsUploaded = 0;
+    std::vector<std::vector<unsigned char>> mips;
+    size_t mipsUploaded = 0;
+    CompressedTexture compressed;
+    size_t levelsUploaded = 0;
+    unsigned int texture = 0;
+
+    // TextureLevel: the level's blocks, uploaded rowsUploaded block rows at
+    // a time.
+    std::vector<unsigned char> levelData;
+
+    bool started = false;
+    GLsync fence = nullptr;
+};
+
+struct AssetLoader {
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::condition_variable jobReady;
+    std::deque<AssetLoadJob> jobs;
+    bool stopping = false;
+
+    MpscQueue<AssetUpload> decoded;
+    std::deque<AssetUpload> uploads;
+    size_t pending = 0;
+
+    // With a shared upload context the upload thread consumes `decoded`
+    // (woken through decodedReady) and hands fenced uploads to the render
+    // thread through `uploaded`. Without one the render thread consumes
+    // `decoded` itself, within uploadBudgetBytes per frame.
+    GLFWwindow *uploadWindow = nullptr;
+    std::thread uploadThread;
+    std::condition_variable decodedReady;
+    MpscQueue<AssetUpload> uploaded;
+
+    Model placeholderMesh;
+    unsigned int placeholderTexture = 0;
+};
+
+AssetLoader loader;
+
+// Set with --sync-load to load every asset before the first frame.
+bool asyncLoading = true;
+
+// Upload bytes the GL thread may spend per frame; set with --upload-budget-kb.
+size_t uploadBudgetBytes = 1024 * 1024;
+
+// Set with --render-thread-uploads to upload on the render thread even when a
+// shared upload context could be created.
+bool useUploadContext = true;
+
+bool buildVirtualTextureCache(const char *sourcePath);
+
+void decodeAsset(AssetUpload &upload)
+{
+    if (upload.job.kind == AssetKind::VirtualTextureCache)
+    {
+        upload.failed = !buildVirtualTextureCache(upload.job.path.c_str());
+        return;
+    }
+    if (upload.job.kind == AssetKind::TextureLevel || upload.job.kind == AssetKind::VirtualTile)
+    {
+        const TextureLevelRequest &level = upload.job.level;
+        upload.failed = !readFileRange(upload.job.path, level.offset, level.size, upload.levelData);
+        return;
+    }
+
+    // Hashed after loading, so a cold load reads the hash back from the
+    // cache it has just written.
+    const char *path = upload.job.path.c_str();
+    if (upload.job.kind == AssetKind::Mesh)
+    {
+        if (!loadPreparedMesh(path, upload.mesh))
+            upload.failed = true;
+    }
+    else if (compressTextures && loadCompressedTexture(path, upload.compressed))
+    {
+        upload.width = upload.compressed.width;
+        upload.height = upload.compressed.height;
+    }
+    else
+    {
+        upload.pixels = loadTextureImage(path, upload.width, upload.height, upload.components);
+        if (!upload.pixels)
+        {
+            std::cerr << "Texture failed to load at path: " << path << std::endl;
+            upload.failed = true;
+        }
+        else if (generateMipsOnCpu)
+        {
+            upload.mips = generateMipChain(upload.pixels, upload.width, upload.height, upload.components, mipOptions);
+        }
+    }
+    if (!upload.failed)
+    {
+        upload.hashed = upload.job.kind == AssetKind::Mesh
+                            ? meshContentHash(path, upload.contentHash, upload.contentSize)
+                            : textureContentHash(path, upload.contentHash, upload.contentSize);
+    }
+}
+
+void runAssetWorker()
+{
+    onWorkerThread = true;
+    for (;;)
+    {
+        AssetUpload upload;
+        {
+            std::unique_lock<std::mutex> lock(loader.jobMutex);
+            loader.jobReady.wait(lock, [] { return loader.stopping || !loader.jobs.empty(); });
+            if (loader.stopping)
+                return;
+            upload.job = std::move(loader.jobs.front());
+            loader.jobs.pop_front();
+        }
+        decodeAsset(upload);
+        mpscPush(loader.decoded, std::move(upload));
+        // Taking the mutex orders the push before the upload thread's
+        // empty check, so the wakeup cannot be lost.
+        {
+            std::lock_guard<std::mutex> lock(loader.jobMutex);
+        }
+        loader.decodedReady.notify_one();
+    }
+}
+
+// Creates the GL objects for a decoded asset on the upload context in one
+// go, then fences them. Only buffers and textures are created here: VAOs are
+// not shared between contexts, so the render thread builds those once the
+// fence has signalled.
+void uploadOnSharedContext(AssetUpload &upload)
+{
+    if (upload.job.kind == AssetKind::Mesh)
+    {
+        PreparedMesh &mesh = upload.mesh;
+        glGenBuffers(1, &mesh.model.VBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.model.VBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, mesh.vertexBytes.size(), mesh.vertexBytes.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &mesh.model.EBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.model.EBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, mesh.indexBytes.size(), mesh.indexBytes.data(), GL_STATIC_DRAW);
+        upload.vertexBytesUploaded = mesh.vertexBytes.size();
+        upload.indexBytesUploaded = mesh.indexBytes.size();
+        std::vector<unsigned char>().swap(mesh.vertexBytes);
+        std::vector<unsigned char>().swap(mesh.indexBytes);
+    }
+    else if (upload.job.kind == AssetKind::VirtualTile || upload.job.kind == AssetKind::VirtualTextureCache)
+    {
+        // Tiles go into a cache slot the render thread picks on arrival, and
+        // built caches are opened there.
+    }
+    else if (upload.job.kind == AssetKind::TextureLevel)
+    {
+        // The render thread never samples this level until it has lowered
+        // the base level, after the fence.
+        const TextureLevelRequest &level = upload.job.level;
+        glBindTexture(GL_TEXTURE_2D, level.texture);
+        glCompressedTexImage2D(GL_TEXTURE_2D, level.level, textureCodecFormat(level.codec), level.width, level.height, 0,
+                               static_cast<GLsizei>(level.size), upload.levelData.data());
+        upload.rowsUploaded = (level.height + 3) / 4;
+        std::vector<unsigned char>().swap(upload.levelData);
+    }
+    else if (!upload.compressed.levelOffsets.empty())
+    {
+        glGenTextures(1, &upload.texture);
+        glBindTexture(GL_TEXTURE_2D, upload.texture);
+        for (size_t level = upload.compressed.firstLevel; level < upload.compressed.levelOffsets.size(); level++)
+            uploadCompressedLevel(upload.compressed, level);
+        setCompressedLevelRange(upload.compressed);
+        setTextureSampling();
+        upload.levelsUploaded = upload.compressed.levelOffsets.size();
+        std::vector<unsigned char>().swap(upload.compressed.data);
+    }
+    else
+    {
+        GLenum format = textureFormat(upload.components);
+        glGenTextures(1, &upload.texture);
+        glBindTexture(GL_TEXTURE_2D, upload.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, upload.width, upload.height, 0, format, GL_UNSIGNED_BYTE, upload.pixels);
+        if (upload.mips.empty())
+            glGenerateMipmap(GL_TEXTURE_2D);
+        else
+            uploadMipLevels(upload.mips, upload.width, upload.height, upload.components);
+        std::vector<std::vector<unsigned char>>().swap(upload.mips);
+        setTextureSampling();
+        upload.rowsUploaded = upload.height;
+        stbi_image_free(upload.pixels);
+        upload.pixels = nullptr;
+    }
+    upload.started = true;
+    upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Without a flush the fence might never reach the GPU, and the render
+    // thread would wait on it forever.
+    glFlush();
+}
+
+void runUploadThread()
+{
+    glfwMakeContextCurrent(loader.uploadWindow);
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(loader.jobMutex);
+            loader.decodedReady.wait(lock, [] { return loader.stopping || !mpscEmpty(loader.decoded); });
+            if (loader.stopping)
+                break;
+        }
+        AssetUpload upload;
+        while (mpscPop(loader.decoded, upload))
+        {
+            if (!upload.failed)
+                uploadOnSharedContext(upload);
+            mpscPush(loader.uploaded, std::move(upload));
+        }
+    }
+    glfwMakeContextCurrent(NULL);
+}
+
+// A unit cube stands in for meshes and a flat grey texel for textures until
+// their real data has been uploaded.
+void startAssetLoader(GLFWwindow *window)
+{
+    MeshData cube;
+    for (int face = 0; face < 6; face++)
+    {
+        int axis = face / 2;
+        float sign = face % 2 ? -1.0f : 1.0f;
+        glm::vec3 normal(0.0f), u(0.0f), v(0.0f);
+        normal[axis] = sign;
+        u[(axis + 1) % 3] = 1.0f;
+        v[(axis + 2) % 3] = sign;
+        unsigned int base = static_cast<unsigned int>(cube.vertices.size() / VERTEX_STRIDE);
+        for (int corner = 0; corner < 4; corner++)
+        {
+            float s = corner == 1 || corner == 2 ? 1.0f : -1.0f;
+            float t = corner >= 2 ? 1.0f : -1.0f;
+            glm::vec3 position = 0.5f * (normal + s * u + t * v);
+            float vertex[VERTEX_STRIDE] = {position.x, position.y, position.z, normal.x, normal.y, normal.z,
+                                           0.5f * s + 0.5f, 0.5f * t + 0.5f};
+            cube.vertices.insert(cube.vertices.end(), vertex, vertex + VERTEX_STRIDE);
+        }
+        unsigned int quad[6] = {base, base + 1, base + 2, base, base + 2, base + 3};
+        cube.indices.insert(cube.indices.end(), quad, quad + 6);
+    }
+    computeBounds(cube);
+    loader.placeholderMesh = uploadMesh(cube);
+
+    const unsigned char grey[3] = {128, 128, 128};
+    glGenTextures(1, &loader.placeholderTexture);
+    glBindTexture(GL_TEXTURE_2D, loader.placeholderTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    unsigned int workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    for (unsigned int i = 0; i < workerCount; i++)
+        loader.workers.emplace_back(runAssetWorker);
+
+    if (useUploadContext)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        loader.uploadWindow = glfwCreateWindow(1, 1, "Asset Upload", NULL, window);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (loader.uploadWindow)
+            loader.uploadThread = std::thread(runUploadThread);
+        else
+            std::cerr << "Failed to create shared upload context, uploading on the render thread" << std::endl;
+    }
+}
+
+void discardAssetUpload(AssetUpload &upload)
+{
+    if (upload.started && upload.job.kind == AssetKind::Mesh)
+        destroyModel(upload.mesh.model);
+    if (upload.started && upload.job.kind == AssetKind::Texture)
+        destroyTexture(upload.texture);
+    stbi_image_free(upload.pixels);
+    upload.pixels = nullptr;
+    if (upload.fence)
+        glDeleteSync(upload.fence);
+    upload.fence = nullptr;
+}
+
+// Forgets levels whose jobs died with the loader; orphaned textures waiting
+// for one are deleted now.
+void abandonStreamedLevels()
+{
+    for (auto entry = textureStreamer.textures.begin(); entry != textureStreamer.textures.end();)
+    {
+        StreamedTexture &streamed = entry->second;
+        if (streamed.pendingLevel >= 0)
+        {
+            textureStreamer.residentBytes -= streamedLevelBytes(streamed, streamed.pendingLevel);
+            streamed.pendingLevel = -1;
+        }
+        unsigned int texture = entry->first;
+        bool orphaned = streamed.orphaned;
+        ++entry;
+        if (orphaned)
+            destroyTexture(texture);
+    }
+}
+
+void stopAssetLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(loader.jobMutex);
+        loader.stopping = true;
+    }
+    loader.jobReady.notify_all();
+    loader.decodedReady.notify_all();
+    for (std::thread &worker : loader.workers)
+        worker.join();
+    loader.workers.clear();
+    if (loader.uploadWindow)
+    {
+        loader.uploadThread.join();
+        glfwDestroyWindow(loader.uploadWindow);
+        loader.uploadWindow = nullptr;
+    }
+
+    AssetUpload upload;
+    while (mpscPop(loader.decoded, upload))
+        discardAssetUpload(upload);
+    while (mpscPop(loader.uploaded, upload))
+        discardAssetUpload(upload);
+    mpscReset(loader.decoded);
+    mpscReset(loader.uploaded);
+    for (AssetUpload &pendingUpload : loader.uploads)
+        discardAssetUpload(pendingUpload);
+    loader.uploads.clear();
+    loader.pending = 0;
+    loader.jobs.clear();
+    abandonStreamedLevels();
+
+    destroyModel(loader.placeholderMesh);
+    destroyTexture(loader.placeholderTexture);
+}
+
+// Returns a handle immediately. Until the upload completes the slot holds a
+// copy of the placeholder; the job records the slot's generation so a
+// result for a slot released in the meantime is dropped.
+template <typename T>
+AssetHandle<T> acquireAssetAsync(AssetPool<T> &pool, const char *path, AssetKind kind, const T &placeholder)
+{
+    std::string key = assetKey(path);
+    auto pathEntry = pool.byPath.find(key);
+    if (pathEntry != pool.byPath.end())
+    {
+        pool.pathHits++;
+        return retainAsset(pool, pathEntry->second);
+    }
+
+    uint32_t index = allocateAssetSlot(pool, key);
+    pool.slots[index].asset = placeholder;
+
+    AssetLoadJob job;
+    job.kind = kind;
+    job.index = index;
+    job.generation = pool.slots[index].generation;
+    job.path = path;
+    {
+        std::lock_guard<std::mutex> lock(loader.jobMutex);
+        loader.jobs.push_back(std::move(job));
+    }
+    loader.jobReady.notify_one();
+    loader.pending++;
+    return retainAsset(pool, index);
+}
+
+// Uploads up to `budget` bytes of the mesh; returns the bytes uploaded. The
+// buffers go through GL_COPY_WRITE_BUFFER so no VAO's element binding is
+// disturbed.
+size_t continueMeshUpload(AssetUpload &upload, size_t budget)
+{
+    PreparedMesh &mesh = upload.mesh;
+    if (!upload.started)
+    {
+        glGenVertexArrays(1, &mesh.model.VAO);
+        glGenBuffers(1, &mesh.model.VBO);
+        glGenBuffers(1, &mesh.model.EBO);
+        glBindVertexArray(mesh.model.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.model.VBO);
+        glBufferData(GL_ARRAY_BUFFER, mesh.vertexBytes.size(), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.model.EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBytes.size(), NULL, GL_STATIC_DRAW);
+        setVertexAttributes(vertexLayout);
+        glBindVertexArray(0);
+        upload.started = true;
+    }
+
+    size_t spent = 0;
+    if (upload.vertexBytesUploaded < mesh.vertexBytes.size())
+    {
+        size_t count = std::min(budget, mesh.vertexBytes.size() - upload.vertexBytesUploaded);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.model.VBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, upload.vertexBytesUploaded, count,
+                        mesh.vertexBytes.data() + upload.vertexBytesUploaded);
+        upload.vertexBytesUploaded += count;
+        spent += count;
+    }
+    if (spent < budget && upload.indexBytesUploaded < mesh.indexBytes.size())
+    {
+        size_t count = std::min(budget - spent, mesh.indexBytes.size() - upload.indexBytesUploaded);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.model.EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, upload.indexBytesUploaded, count,
+                        mesh.indexBytes.data() + upload.indexBytesUploaded);
+        upload.indexBytesUploaded += count;
+        spent += count;
+    }
+    return spent;
+}
+
+// Uploads whole levels of a compressed texture, at least one per call, up to
+// `budget` bytes.
+size_t continueCompressedTextureUpload(AssetUpload &upload, size_t budget)
+{
+    const CompressedTexture &compressed = upload.compressed;
+    glActiveTexture(GL_TEXTURE0);
+    if (!upload.started)
+    {
+        glGenTextures(1, &upload.texture);
+        upload.levelsUploaded = compressed.firstLevel;
+        upload.started = true;
+    }
+    glBindTexture(GL_TEXTURE_2D, upload.texture);
+
+    size_t spent = 0;
+    while (upload.levelsUploaded < compressed.levelOffsets.size() &&
+           (spent == 0 || spent + compressedLevelBytes(compressed, upload.levelsUploaded) <= budget))
+    {
+        uploadCompressedLevel(compressed, upload.levelsUploaded);
+        spent += compressedLevelBytes(compressed, upload.levelsUploaded);
+        upload.levelsUploaded++;
+    }
+    if (upload.levelsUploaded == compressed.levelOffsets.size())
+    {
+        setCompressedLevelRange(compressed);
+        setTextureSampling();
+    }
+    return spent;
+}
+
+// Uploads whole rows of the base level, then whole CPU-generated mip levels,
+// at least one row or level per call, up to `budget` bytes. Without CPU mips
+// the chain is generated by GL once the last row is in.
+size_t continueTextureUpload(AssetUpload &upload, size_t budget)
+{
+    if (!upload.compressed.levelOffsets.empty())
+        return continueCompressedTextureUpload(upload, budget);
+
+    GLenum format = textureFormat(upload.components);
+    glActiveTexture(GL_TEXTURE0);
+    if (!upload.started)
+    {
+        glGenTextures(1, &upload.texture);
+        glBindTexture(GL_TEXTURE_2D, upload.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, upload.width, upload.height, 0, format, GL_UNSIGNED_BYTE, NULL);
+        upload.started = true;
+    }
+    glBindTexture(GL_TEXTURE_2D, upload.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    size_t spent = 0;
+    if (upload.rowsUploaded < upload.height)
+    {
+        size_t rowBytes = static_cast<size_t>(upload.width) * upload.components;
+        int rows = static_cast<int>(std::min<size_t>(std::max<size_t>(budget / rowBytes, 1),
+                                                     upload.height - upload.rowsUploaded));
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.rowsUploaded, upload.width, rows, format, GL_UNSIGNED_BYTE,
+                        upload.pixels + upload.rowsUploaded * rowBytes);
+        upload.rowsUploaded += rows;
+        spent = rows * rowBytes;
+        if (upload.rowsUploaded == upload.height && upload.mips.empty())
+            glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    while (upload.rowsUploaded == upload.height && upload.mipsUploaded < upload.mips.size() &&
+           (spent == 0 || spent + upload.mips[upload.mipsUploaded].size() <= budget))
+    {
+        int level = static_cast<int>(upload.mipsUploaded + 1);
+        int width = std::max(1, upload.width >> level), height = std::max(1, upload.height >> level);
+        glTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, format, GL_UNSIGNED_BYTE,
+                     upload.mips[upload.mipsUploaded].data());
+        spent += upload.mips[upload.mipsUploaded].size();
+        upload.mipsUploaded++;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (upload.rowsUploaded == upload.height && upload.mipsUploaded == upload.mips.size())
+        setTextureSampling();
+    return spent;
+}
+
+bool assetUploadDone(const AssetUpload &upload)
+{
+    if (upload.job.kind == AssetKind::Mesh)
+        return upload.vertexBytesUploaded == upload.mesh.vertexBytes.size() &&
+               upload.indexBytesUploaded == upload.mesh.indexBytes.size();
+    if (!upload.compressed.levelOffsets.empty())
+        return upload.levelsUploaded == upload.compressed.levelOffsets.size();
+    return upload.rowsUploaded == upload.height && upload.mipsUploaded == upload.mips.size();
+}
+
+// Moves a finished (or failed, or duplicate) upload into its slot. Returns
+// false if the slot was released while the asset was loading.
+template <typename T>
+bool completeAsset(AssetPool<T> &pool, AssetUpload &upload, const T &asset, bool shareable)
+{
+    if (pool.slots[upload.job.index].generation != upload.job.generation)
+        return false;
+
+    typename AssetPool<T>::Slot &slot = pool.slots[upload.job.index];
+    if (upload.failed)
+        return true;
+    pool.assetVersion++;
+
+    uint32_t existing = upload.hashed ? findAssetContent(pool, upload.contentHash, upload.contentSize)
+                                      : NO_ASSET_SLOT;
+    if (shareable && existing != NO_ASSET_SLOT)
+    {
+        std::cout << "Sharing " << upload.job.path << " with identical "
+                  << pool.slots[existing].paths.front() << std::endl;
+        pool.contentHits++;
+        pool.loads--;
+        slot.asset = pool.slots[existing].asset;
+        slot.aliasOf = existing;
+        pool.slots[existing].refCount++;
+        return true;
+    }
+
+    slot.asset = asset;
+    slot.loaded = true;
+    setAssetContent(pool, upload.job.index, upload.hashed, upload.contentHash, upload.contentSize);
+    return true;
+}
+
+template <typename T>
+bool assetSlotCurrent(const AssetPool<T> &pool, const AssetLoadJob &job)
+{
+    return pool.slots[job.index].generation == job.generation;
+}
+
+bool duplicatesResidentAsset(const AssetUpload &upload)
+{
+    if (!upload.hashed)
+        return false;
+    if (upload.job.kind == AssetKind::Mesh)
+        return findAssetContent(assets.meshes, upload.contentHash, upload.contentSize) != NO_ASSET_SLOT;
+    return findAssetContent(assets.textures, upload.contentHash, upload.contentSize) != NO_ASSET_SLOT;
+}
+
+// Publishes a fully uploaded (or failed, or duplicate) asset to its slot and
+// frees whatever the slot does not take over.
+void finishAssetUpload(AssetUpload &upload, bool duplicate)
+{
+    bool kept = upload.job.kind == AssetKind::Mesh
+                    ? completeAsset(assets.meshes, upload, upload.mesh.model, duplicate)
+                    : completeAsset(assets.textures, upload, upload.texture, duplicate);
+    if (!kept || upload.failed || duplicate)
+    {
+        discardAssetUpload(upload);
+    }
+    else
+    {
+        stbi_image_free(upload.pixels);
+        upload.pixels = nullptr;
+        if (upload.job.kind == AssetKind::Texture && upload.compressed.firstLevel > 0)
+            registerStreamedTexture(upload.texture, upload.compressed);
+    }
+    loader.pending--;
+}
+
+// Levels requested at once across all streamed textures.
+const int MAX_STREAMING_LEVELS = 4;
+
+// Uploads whole block rows of a streamed level, at least one per call, up to
+// `budget` bytes. The level is defined empty first so rows can be sub-imaged
+// into it; it is not sampled until finishLevelUpload lowers the base level.
+size_t continueLevelUpload(AssetUpload &upload, size_t budget)
+{
+    const TextureLevelRequest &level = upload.job.level;
+    GLenum format = textureCodecFormat(level.codec);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, level.texture);
+    if (!upload.started)
+    {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level.level, format, level.width, level.height, 0,
+                               static_cast<GLsizei>(level.size), NULL);
+        upload.started = true;
+    }
+
+    int blockRows = (level.height + 3) / 4;
+    size_t rowBytes = level.size / blockRows;
+    int rows = static_cast<int>(std::min<size_t>(std::max<size_t>(budget / rowBytes, 1), blockRows - upload.rowsUploaded));
+    int y = upload.rowsUploaded * 4;
+    glCompressedTexSubImage2D(GL_TEXTURE_2D, level.level, 0, y, level.width, std::min(rows * 4, level.height - y), format,
+                              static_cast<GLsizei>(rows * rowBytes), upload.levelData.data() + upload.rowsUploaded * rowBytes);
+    upload.rowsUploaded += rows;
+    return rows * rowBytes;
+}
+
+bool levelUploadDone(const AssetUpload &upload)
+{
+    return upload.rowsUploaded == (upload.job.level.height + 3) / 4;
+}
+
+bool streamedTextureOrphaned(unsigned int texture)
+{
+    auto entry = textureStreamer.textures.find(texture);
+    return entry == textureStreamer.textures.end() || entry->second.orphaned;
+}
+
+// Makes an uploaded level the texture's new base level, or gives up on it.
+// The previous base stays the effective one through MIN_LOD, which
+// updateTextureStreaming then fades down so the new detail does not pop.
+void finishLevelUpload(AssetUpload &upload)
+{
+    const TextureLevelRequest &level = upload.job.level;
+    auto entry = textureStreamer.textures.find(level.texture);
+    if (entry == textureStreamer.textures.end())
+        return;
+    StreamedTexture &streamed = entry->second;
+    streamed.pendingLevel = -1;
+    if (streamed.orphaned || upload.failed)
+    {
+        textureStreamer.residentBytes -= level.size;
+        if (upload.failed)
+            streamed.finestLevel = level.level + 1;
+        if (streamed.orphaned)
+        {
+            unsigned int texture = level.texture;
+            destroyTexture(texture);
+        }
+        return;
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, level.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level.level);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, 1.0f);
+    streamed.baseLevel = level.level;
+    streamed.minLod = 1.0f;
+    textureStreamer.levelsStreamed++;
+}
+
+// Reads the next finer level on a worker, or right here when loading
+// synchronously.
+void requestStreamedLevel(unsigned int texture, StreamedTexture &streamed, int level)
+{
+    AssetLoadJob job;
+    job.kind = AssetKind::TextureLevel;
+    job.path = streamed.cachePath;
+    job.level.texture = texture;
+    job.level.level = level;
+    job.level.codec = streamed.codec;
+    job.level.width = std::max(1, streamed.width >> level);
+    job.level.height = std::max(1, streamed.height >> level);
+    job.level.offset = sizeof(TextureCacheHeader) + streamed.levelOffsets[level];
+    job.level.size = streamedLevelBytes(streamed, level);
+    streamed.pendingLevel = level;
+    textureStreamer.residentBytes += job.level.size;
+
+    if (loader.workers.empty())
+    {
+        AssetUpload upload;
+        upload.job = std::move(job);
+        decodeAsset(upload);
+        if (!upload.failed)
+            continueLevelUpload(upload, upload.job.level.size);
+        finishLevelUpload(upload);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(loader.jobMutex);
+        loader.jobs.push_back(std::move(job));
+    }
+    loader.jobReady.notify_one();
+}
+
+// Drops the finest resident level of the texture holding the most detail
+// beyond what was asked of it. Levels in demand are never evicted, so a
+// budget too small for the scene stops refinement instead of thrashing.
+bool evictStreamedLevel()
+{
+    unsigned int victim = 0;
+    int victimSurplus = 0;
+    for (auto &entry : textureStreamer.textures)
+    {
+        const StreamedTexture &streamed = entry.second;
+        int surplus = std::min(streamed.desiredLevel, streamed.tailLevel) - streamed.baseLevel;
+        if (streamed.pendingLevel < 0 && !streamed.orphaned && surplus > victimSurplus)
+        {
+            victim = entry.first;
+            victimSurplus = surplus;
+        }
+    }
+    if (victimSurplus == 0)
+        return false;
+
+    StreamedTexture &streamed = textureStreamer.textures[victim];
+    int level = streamed.baseLevel++;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, victim);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, streamed.baseLevel);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, -1000.0f);
+    streamed.minLod = 0.0f;
+    // Redefining the level as empty is what actually releases its storage.
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, textureCodecFormat(streamed.codec), 0, 0, 0, 0, NULL);
+    textureStreamer.residentBytes -= streamedLevelBytes(streamed, level);
+    textureStreamer.levelsEvicted++;
+    return true;
+}
+
+// Called once per frame on the GL thread after the frame's draws have
+// recorded their demand. Fades in arrived levels, then requests the next
+// finer level for the textures furthest short of their demand, evicting
+// surplus detail to stay within budget.
+void updateTextureStreaming()
+{
+    int inFlight = 0;
+    for (auto &entry : textureStreamer.textures)
+    {
+        StreamedTexture &streamed = entry.second;
+        if (streamed.pendingLevel >= 0)
+            inFlight++;
+        if (streamed.minLod > 0.0f && !streamed.orphaned)
+        {
+            streamed.minLod = std::max(0.0f, streamed.minLod - 0.125f);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, entry.first);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, streamed.minLod > 0.0f ? streamed.minLod : -1000.0f);
+        }
+    }
+
+    while (inFlight < MAX_STREAMING_LEVELS)
+    {
+        unsigned int neediest = 0;
+        int deficit = 0;
+        for (auto &entry : textureStreamer.textures)
+        {
+            const StreamedTexture &streamed = entry.second;
+            int shortfall = streamed.baseLevel - std::max(streamed.desiredLevel, streamed.finestLevel);
+            if (streamed.pendingLevel < 0 && !streamed.orphaned && shortfall > deficit)
+            {
+                neediest = entry.first;
+                deficit = shortfall;
+            }
+        }
+        if (deficit == 0)
+            break;
+
+        StreamedTexture &streamed = textureStreamer.textures[neediest];
+        size_t bytes = streamedLevelBytes(streamed, streamed.baseLevel - 1);
+        while (textureStreamer.residentBytes + bytes > textureStreamer.budgetBytes && evictStreamedLevel())
+            ;
+        if (textureStreamer.residentBytes + bytes > textureStreamer.budgetBytes)
+            break;
+        requestStreamedLevel(neediest, streamed, streamed.baseLevel - 1);
+        inFlight++;
+    }
+
+    for (auto &entry : textureStreamer.textures)
+        entry.second.desiredLevel = entry.second.tailLevel;
+}
+
+void reportTextureStreaming()
+{
+    if (textureStreamer.textures.empty())
+        return;
+    std::cout << "Streamed textures: " << textureStreamer.residentBytes / 1024 << " KB resident of "
+              << textureStreamer.budgetBytes / 1024 << " KB budget, " << textureStreamer.levelsStreamed
+              << " levels streamed in, " << textureStreamer.levelsEvicted << " evicted" << std::endl;
+}
+
+// Virtual texturing: a texture too large to allocate is cut into bordered
+// tiles at every level and stored in a .vtcache next to the source. Only the
+// tiles the feedback pass finds on screen are kept, in the fixed-size
+// physical cache texture; each virtual texture's page table maps tiles to
+// cache slots, pointing tiles that are not resident at their finest resident
+// ancestor. Texture memory is the cache plus one texel per tile, however much
+// virtual texture the scene references.
+const int VIRTUAL_TILE_SIZE = 128;
+const int VIRTUAL_TILE_BORDER = 1;
+const int VIRTUAL_TILE_SPAN = VIRTUAL_TILE_SIZE + 2 * VIRTUAL_TILE_BORDER;
+const size_t VIRTUAL_TILE_BYTES = size_t(VIRTUAL_TILE_SPAN) * VIRTUAL_TILE_SPAN * 4;
+
+// Tile keys pack the texture id, level and tile position into 8 bits each.
+const int MAX_VIRTUAL_PAGES = 256;
+const int MAX_VIRTUAL_TEXTURES = 254;
+const uint32_t NO_VIRTUAL_TILE = 0xFFFFFFFFu;
+
+// The feedback target is this many times smaller than the window on each
+// side; MAX_VIRTUAL_TILE_REQUESTS caps the tile reads in flight.
+const int FEEDBACK_DIVISOR = 8;
+const size_t MAX_VIRTUAL_TILE_REQUESTS = 16;
+
+const char VIRTUAL_TEXTURE_MAGIC[4] = {'V', 'T', 'E', 'X'};
+const uint32_t VIRTUAL_TEXTURE_VERSION = 1;
+
+// On-disk layout of a .vtcache file: this header, then every level's tiles in
+// row-major order, each VIRTUAL_TILE_SPAN texels square in RGBA8 with a
+// wrapped border. flags are the texture cache's mip flags.
+struct VirtualTextureHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    uint32_t flags;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tileSize;
+};
+
+// The page table is pagesWide x pagesHigh at level 0 (rounded up to powers
+// of two so its levels form a mip chain) and halves down to 1x1 at the last
+// level. slots holds, per level and page, the cache slot of that tile or -1.
+struct VirtualTexture {
+    std::string cachePath;
+    int width = 0, height = 0;
+    int pagesWide = 0, pagesHigh = 0;
+    int levelCount = 0;
+    std::vector<size_t> levelTileBase;
+    std::vector<std::vector<int>> slots;
+    unsigned int pageTable = 0;
+    bool dirty = true;
+};
+
+struct VirtualTileSlot {
+    uint32_t key = NO_VIRTUAL_TILE;
+    uint64_t lastUsed = 0;
+    bool pinned = false;
+};
+
+// Feedback is read back through two pixel buffers, so a frame maps the one
+// written the frame before rather than waiting on its own.
+struct VirtualTextureSystem {
+    std::vector<VirtualTexture> textures;
+    std::unordered_map<std::string, int> byPath;
+
+    int cacheTilesPerSide = 16;
+    unsigned int physicalCache = 0;
+    std::vector<VirtualTileSlot> slots;
+    std::unordered_map<uint32_t, int> residentTiles;
+    std::unordered_set<uint32_t> loadingTiles;
+
+    unsigned int feedbackFBO = 0, feedbackColor = 0, feedbackDepth = 0;
+    unsigned int feedbackBuffers[2] = {0, 0};
+    int feedbackWidth = 0, feedbackHeight = 0;
+    uint64_t frame = 0;
+
+    size_t tilesLoaded = 0;
+    size_t tilesEvicted = 0;
+};
+
+VirtualTextureSystem virtualTextures;
+
+// Set with --virtual-textures to sample every texture through the virtual
+// texture cache, whose side in tiles is set with --virtual-cache-tiles.
+bool useVirtualTextures = false;
+
+int virtualTilesWide(const VirtualTexture &texture, int level)
+{
+    return (std::max(1, texture.width >> level) + VIRTUAL_TILE_SIZE - 1) / VIRTUAL_TILE_SIZE;
+}
+
+int virtualTilesHigh(const VirtualTexture &texture, int level)
+{
+    return (std::max(1, texture.height >> level) + VIRTUAL_TILE_SIZE - 1) / VIRTUAL_TILE_SIZE;
+}
+
+uint32_t virtualTileKey(int texture, int level, int x, int y)
+{
+    return static_cast<uint32_t>(texture) << 24 | static_cast<uint32_t>(level) << 16 |
+           static_cast<uint32_t>(y) << 8 | static_cast<uint32_t>(x);
+}
+
+void setVirtualPageGrid(VirtualTexture &texture)
+{
+    texture.pagesWide = 1;
+    texture.pagesHigh = 1;
+    while (texture.pagesWide * VIRTUAL_TILE_SIZE < texture.width)
+        texture.pagesWide *= 2;
+    while (texture.pagesHigh * VIRTUAL_TILE_SIZE < texture.height)
+        texture.pagesHigh *= 2;
+    texture.levelCount = 1;
+    while ((std::max(texture.pagesWide, texture.pagesHigh) >> (texture.levelCount - 1)) > 1)
+        texture.levelCount++;
+}
+
+std::string virtualTextureCachePath(const char *sourcePath)
+{
+    return std::string(sourcePath) + ".vtcache";
+}
+
+uint32_t virtualTextureCacheFlags()
+{
+    return textureCacheFlags() & ~TEXTURE_CACHE_PREFER_BC7;
+}
+
+// Decodes the source, builds its mip chain and writes every level's tiles.
+// Runs on a loader worker when loading asynchronously.
+bool buildVirtualTextureCache(const char *sourcePath)
+{
+    std::string cachePath = virtualTextureCachePath(sourcePath);
+    VirtualTextureHeader header = {};
+    memcpy(header.magic, VIRTUAL_TEXTURE_MAGIC, sizeof(VIRTUAL_TEXTURE_MAGIC));
+    header.version = VIRTUAL_TEXTURE_VERSION;
+    if (!getSourceStamp(sourcePath, header.sourceSize, header.sourceModified))
+    {
+        std::cerr << "Texture failed to load at path: " << sourcePath << std::endl;
+        return false;
+    }
+
+    int width, height, components;
+    unsigned char *pixels = stbi_load(sourcePath, &width, &height, &components, 4);
+    if (!pixels)
+    {
+        std::cerr << "Texture failed to load at path: " << sourcePath << std::endl;
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    header.flags = virtualTextureCacheFlags();
+    header.width = static_cast<uint32_t>(width);
+    header.height = static_cast<uint32_t>(height);
+    header.tileSize = VIRTUAL_TILE_SIZE;
+
+    VirtualTexture texture;
+    texture.width = width;
+    texture.height = height;
+    setVirtualPageGrid(texture);
+    std::vector<std::vector<unsigned char>> mips = generateMipChain(pixels, width, height, 4, mipOptions);
+
+    std::string tempPath = cachePath + ".tmp";
+    size_t tileCount = 0;
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        std::vector<unsigned char> tile(VIRTUAL_TILE_BYTES);
+        for (int level = 0; level < texture.levelCount; level++)
+        {
+            const unsigned char *image = level == 0 ? pixels : mips[level - 1].data();
+            int levelWidth = std::max(1, width >> level), levelHeight = std::max(1, height >> level);
+            for (int ty = 0; ty < virtualTilesHigh(texture, level); ty++)
+            {
+                for (int tx = 0; tx < virtualTilesWide(texture, level); tx++)
+                {
+                    // Texels past the edge and the border wrap, as the
+                    // texture repeats.
+                    for (int y = 0; y < VIRTUAL_TILE_SPAN; y++)
+                    {
+                        int sourceY = ((ty * VIRTUAL_TILE_SIZE - VIRTUAL_TILE_BORDER + y) % levelHeight + levelHeight) % levelHeight;
+                        for (int x = 0; x < VIRTUAL_TILE_SPAN; x++)
+                        {
+                            int sourceX = ((tx * VIRTUAL_TILE_SIZE - VIRTUAL_TILE_BORDER + x) % levelWidth + levelWidth) % levelWidth;
+                            memcpy(&tile[(static_cast<size_t>(y) * VIRTUAL_TILE_SPAN + x) * 4],
+                                   image + (static_cast<size_t>(sourceY) * levelWidth + sourceX) * 4, 4);
+                        }
+                    }
+                    out.write(reinterpret_cast<const char *>(tile.data()), tile.size());
+                    tileCount++;
+                }
+            }
+        }
+        stbi_image_free(pixels);
+        if (!out)
+        {
+            std::cerr << "Failed to write virtual texture cache: " << cachePath << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec)
+    {
+        std::cerr << "Failed to write virtual texture cache: " << cachePath << std::endl;
+        return false;
+    }
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Built virtual texture " << sourcePath << ": " << width << "x" << height << ", "
+              << texture.levelCount << " levels, " << tileCount << " tiles in " << elapsed << " ms" << std::endl;
+    return true;
+}
+
+// Reads the tile layout from the .vtcache for `path`; false if there is
+// none, or it is not current.
+bool readVirtualTexture(const char *path, VirtualTexture &texture)
+{
+    std::string cachePath = virtualTextureCachePath(path);
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    if (!getSourceStamp(path, sourceSize, sourceModified))
+        return false;
+
+    VirtualTextureHeader header = {};
+    {
+        std::ifstream in(cachePath, std::ios::binary);
+        in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    }
+    bool valid = memcmp(header.magic, VIRTUAL_TEXTURE_MAGIC, sizeof(VIRTUAL_TEXTURE_MAGIC)) == 0 &&
+                 header.version == VIRTUAL_TEXTURE_VERSION &&
+                 header.flags == virtualTextureCacheFlags() &&
+                 header.sourceSize == sourceSize &&
+                 header.sourceModified == sourceModified &&
+                 header.tileSize == VIRTUAL_TILE_SIZE &&
+                 header.width > 0 && header.height > 0;
+    if (!valid)
+        return false;
+
+    texture.cachePath = cachePath;
+    texture.width = static_cast<int>(header.width);
+    texture.height = static_cast<int>(header.height);
+    setVirtualPageGrid(texture);
+    size_t tileCount = 0;
+    texture.levelTileBase.clear();
+    texture.slots.clear();
+    for (int level = 0; level < texture.levelCount; level++)
+    {
+        texture.levelTileBase.push_back(tileCount);
+        tileCount += static_cast<size_t>(virtualTilesWide(texture, level)) * virtualTilesHigh(texture, level);
+        size_t pages = static_cast<size_t>(std::max(1, texture.pagesWide >> level)) *
+                       std::max(1, texture.pagesHigh >> level);
+        texture.slots.emplace_back(pages, -1);
+    }
+    std::error_code ec;
+    return std::filesystem::file_size(cachePath, ec) == sizeof(header) + tileCount * VIRTUAL_TILE_BYTES && !ec;
+}
+
+// The physical cache and the feedback target with its readback buffers.
+void createVirtualTextureCache()
+{
+    int side = virtualTextures.cacheTilesPerSide * VIRTUAL_TILE_SPAN;
+    glGenTextures(1, &virtualTextures.physicalCache);
+    glBindTexture(GL_TEXTURE_2D, virtualTextures.physicalCache);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, side, side, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    virtualTextures.slots.assign(static_cast<size_t>(virtualTextures.cacheTilesPerSide) * virtualTextures.cacheTilesPerSide,
+                                 VirtualTileSlot());
+
+    virtualTextures.feedbackWidth = 800 / FEEDBACK_DIVISOR;
+    virtualTextures.feedbackHeight = 600 / FEEDBACK_DIVISOR;
+    glGenTextures(1, &virtualTextures.feedbackColor);
+    glBindTexture(GL_TEXTURE_2D, virtualTextures.feedbackColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, virtualTextures.feedbackWidth, virtualTextures.feedbackHeight, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenRenderbuffers(1, &virtualTextures.feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, virtualTextures.feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, virtualTextures.feedbackWidth, virtualTextures.feedbackHeight);
+    glGenFramebuffers(1, &virtualTextures.feedbackFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, virtualTextures.feedbackFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, virtualTextures.feedbackColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, virtualTextures.feedbackDepth);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(2, virtualTextures.feedbackBuffers);
+    for (unsigned int buffer : virtualTextures.feedbackBuffers)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<size_t>(virtualTextures.feedbackWidth) * virtualTextures.feedbackHeight * 4,
+                     NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Takes a free cache slot, or the least recently used one not needed this
+// frame, unmapping its tile. Returns -1 if every slot is in use.
+int allocateVirtualTileSlot()
+{
+    int chosen = -1;
+    for (size_t i = 0; i < virtualTextures.slots.size(); i++)
+    {
+        const VirtualTileSlot &slot = virtualTextures.slots[i];
+        if (slot.key == NO_VIRTUAL_TILE)
+            return static_cast<int>(i);
+        if (!slot.pinned && slot.lastUsed < virtualTextures.frame &&
+            (chosen < 0 || slot.lastUsed < virtualTextures.slots[chosen].lastUsed))
+            chosen = static_cast<int>(i);
+    }
+    if (chosen < 0)
+        return -1;
+
+    uint32_t key = virtualTextures.slots[chosen].key;
+    VirtualTexture &texture = virtualTextures.textures[key >> 24];
+    int level = (key >> 16) & 0xFF;
+    texture.slots[level][((key >> 8) & 0xFF) * std::max(1, texture.pagesWide >> level) + (key & 0xFF)] = -1;
+    texture.dirty = true;
+    virtualTextures.residentTiles.erase(key);
+    virtualTextures.slots[chosen].key = NO_VIRTUAL_TILE;
+    virtualTextures.tilesEvicted++;
+    return chosen;
+}
+
+void commitVirtualTile(uint32_t key, const unsigned char *texels, bool pinned)
+{
+    int slotIndex = allocateVirtualTileSlot();
+    if (slotIndex < 0)
+        return;
+    int side = virtualTextures.cacheTilesPerSide;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, virtualTextures.physicalCache);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, slotIndex % side * VIRTUAL_TILE_SPAN, slotIndex / side * VIRTUAL_TILE_SPAN,
+                    VIRTUAL_TILE_SPAN, VIRTUAL_TILE_SPAN, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+
+    VirtualTileSlot &slot = virtualTextures.slots[slotIndex];
+    slot.key = key;
+    slot.lastUsed = virtualTextures.frame;
+    slot.pinned = pinned;
+    VirtualTexture &texture = virtualTextures.textures[key >> 24];
+    int level = (key >> 16) & 0xFF;
+    texture.slots[level][((key >> 8) & 0xFF) * std::max(1, texture.pagesWide >> level) + (key & 0xFF)] = slotIndex;
+    texture.dirty = true;
+    virtualTextures.residentTiles[key] = slotIndex;
+    virtualTextures.tilesLoaded++;
+}
+
+// Reads a tile on a worker, or right here when loading synchronously.
+void requestVirtualTile(uint32_t key, bool pinned)
+{
+    const VirtualTexture &texture = virtualTextures.textures[key >> 24];
+    int level = (key >> 16) & 0xFF;
+    size_t tile = texture.levelTileBase[level] + ((key >> 8) & 0xFF) * virtualTilesWide(texture, level) + (key & 0xFF);
+
+    AssetLoadJob job;
+    job.kind = AssetKind::VirtualTile;
+    job.index = key;
+    job.path = texture.cachePath;
+    job.level.offset = sizeof(VirtualTextureHeader) + tile * VIRTUAL_TILE_BYTES;
+    job.level.size = VIRTUAL_TILE_BYTES;
+    if (pinned || loader.workers.empty())
+    {
+        std::vector<unsigned char> texels;
+        if (readFileRange(job.path, job.level.offset, job.level.size, texels))
+            commitVirtualTile(key, texels.data(), pinned);
+        return;
+    }
+
+    virtualTextures.loadingTiles.insert(key);
+    {
+        std::lock_guard<std::mutex> lock(loader.jobMutex);
+        loader.jobs.push_back(std::move(job));
+    }
+    loader.jobReady.notify_one();
+}
+
+void finishVirtualTileUpload(AssetUpload &upload)
+{
+    if (virtualTextures.loadingTiles.erase(upload.job.index) && !upload.failed)
+        commitVirtualTile(upload.job.index, upload.levelData.data(), false);
+}
+
+// Gives a virtual texture whose layout has been read its page table, and
+// loads its last level (a single tile) now and pins it, so every lookup has
+// a tile to fall back to. False if the texture is too large to address.
+bool activateVirtualTexture(int id, const char *path)
+{
+    VirtualTexture &texture = virtualTextures.textures[id];
+    if (texture.pagesWide > MAX_VIRTUAL_PAGES || texture.pagesHigh > MAX_VIRTUAL_PAGES)
+    {
+        std::cerr << "Virtual texture " << path << " exceeds " << MAX_VIRTUAL_PAGES * VIRTUAL_TILE_SIZE
+                  << " texels on a side" << std::endl;
+        return false;
+    }
+
+    glGenTextures(1, &texture.pageTable);
+    glBindTexture(GL_TEXTURE_2D, texture.pageTable);
+    for (int level = 0; level < texture.levelCount; level++)
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, std::max(1, texture.pagesWide >> level),
+                     std::max(1, texture.pagesHigh >> level), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    requestVirtualTile(virtualTileKey(id, texture.levelCount - 1, 0, 0), true);
+    return true;
+}
+
+// A virtual texture is drawn through the cache once it has a page table;
+// until then its cache is still being built and draws use the loader's
+// placeholder texture.
+bool virtualTextureReady(int id)
+{
+    return virtualTextures.textures[id].pageTable != 0;
+}
+
+// Returns the id of the virtual texture for `path`, or -1. A .vtcache that
+// is missing or stale is built on a loader worker when there are any, and
+// the texture is activated by finishVirtualTextureBuild.
+int loadVirtualTexture(const char *path)
+{
+    std::string key = assetKey(path);
+    auto entry = virtualTextures.byPath.find(key);
+    if (entry != virtualTextures.byPath.end())
+        return entry->second;
+    if (virtualTextures.textures.size() >= MAX_VIRTUAL_TEXTURES)
+    {
+        std::cerr << "Too many virtual textures, loading " << path << " as a texture" << std::endl;
+        return -1;
+    }
+
+    VirtualTexture texture;
+    bool current = readVirtualTexture(path, texture);
+    if (!current && loader.workers.empty() && !(buildVirtualTextureCache(path) && readVirtualTexture(path, texture)))
+        return -1;
+    if (!virtualTextures.physicalCache)
+        createVirtualTextureCache();
+
+    int id = static_cast<int>(virtualTextures.textures.size());
+    virtualTextures.textures.push_back(std::move(texture));
+    if (!current && !loader.workers.empty())
+    {
+        AssetLoadJob job;
+        job.kind = AssetKind::VirtualTextureCache;
+        job.index = static_cast<uint32_t>(id);
+        job.path = path;
+        {
+            std::lock_guard<std::mutex> lock(loader.jobMutex);
+            loader.jobs.push_back(std::move(job));
+        }
+        loader.jobReady.notify_one();
+        loader.pending++;
+    }
+    else if (!activateVirtualTexture(id, path))
+    {
+        virtualTextures.textures.pop_back();
+        return -1;
+    }
+    virtualTextures.byPath[key] = id;
+    return id;
+}
+
+// A texture whose cache failed to build keeps the placeholder.
+void finishVirtualTextureBuild(AssetUpload &upload)
+{
+    int id = static_cast<int>(upload.job.index);
+    if (!upload.failed && readVirtualTexture(upload.job.path.c_str(), virtualTextures.textures[id]))
+        activateVirtualTexture(id, upload.job.path.c_str());
+    loader.pending--;
+}
+
+// Rewrites the page tables whose mappings changed, coarsest level first so
+// each unmapped page can take its parent's entry.
+void updateVirtualPageTables()
+{
+    int side = virtualTextures.cacheTilesPerSide;
+    for (VirtualTexture &texture : virtualTextures.textures)
+    {
+        if (!texture.dirty || !texture.pageTable)
+            continue;
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture.pageTable);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        std::vector<unsigned char> parent, entries;
+        for (int level = texture.levelCount - 1; level >= 0; level--)
+        {
+            int pagesWide = std::max(1, texture.pagesWide >> level), pagesHigh = std::max(1, texture.pagesHigh >> level);
+            int parentWide = std::max(1, texture.pagesWide >> (level + 1));
+            entries.assign(static_cast<size_t>(pagesWide) * pagesHigh * 4, 0);
+            for (int y = 0; y < pagesHigh; y++)
+            {
+                for (int x = 0; x < pagesWide; x++)
+                {
+                    unsigned char *entry = &entries[(static_cast<size_t>(y) * pagesWide + x) * 4];
+                    int slot = texture.slots[level][static_cast<size_t>(y) * pagesWide + x];
+                    if (slot >= 0)
+                    {
+                        entry[0] = static_cast<unsigned char>(slot % side);
+                        entry[1] = static_cast<unsigned char>(slot / side);
+                        entry[2] = static_cast<unsigned char>(level);
+                        entry[3] = 255;
+                    }
+                    else if (!parent.empty())
+                    {
+                        memcpy(entry, &parent[(static_cast<size_t>(y / 2) * parentWide + x / 2) * 4], 4);
+                    }
+                }
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, pagesWide, pagesHigh, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+            parent.swap(entries);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        texture.dirty = false;
+    }
+}
+
+void setVirtualTextureUniforms(const ShaderProgram &program, int id)
+{
+    const VirtualTexture &texture = virtualTextures.textures[id];
+    setUniform(program, UNIFORM_VIRTUAL_SIZE, glm::vec2(static_cast<float>(texture.width), static_cast<float>(texture.height)));
+    setUniform(program, UNIFORM_VIRTUAL_LEVELS, texture.levelCount);
+}
+
+void bindVirtualTextureCache()
+{
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, virtualTextures.physicalCache);
+}
+
+void beginVirtualTextureFeedback(const ShaderProgram &program)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, virtualTextures.feedbackFBO);
+    glViewport(0, 0, virtualTextures.feedbackWidth, virtualTextures.feedbackHeight);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    useShaderProgram(program);
+    setUniform(program, UNIFORM_FEEDBACK_BIAS, -std::log2(static_cast<float>(FEEDBACK_DIVISOR)));
+}
+
+// Marks the tiles seen in a feedback image, and every ancestor, as used this
+// frame, then requests the missing ones coarsest first.
+void processVirtualTextureFeedback(const unsigned char *pixels, size_t pixelCount)
+{
+    std::vector<uint32_t> seen;
+    for (size_t i = 0; i < pixelCount; i++)
+    {
+        const unsigned char *texel = pixels + i * 4;
+        int id = texel[3] - 1;
+        if (id < 0 || id >= static_cast<int>(virtualTextures.textures.size()))
+            continue;
+        seen.push_back(virtualTileKey(id, texel[2], texel[0], texel[1]));
+    }
+    std::sort(seen.begin(), seen.end());
+    seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+
+    std::vector<uint32_t> missing;
+    std::unordered_set<uint32_t> visited;
+    for (uint32_t key : seen)
+    {
+        int id = key >> 24, level = (key >> 16) & 0xFF, x = key & 0xFF, y = (key >> 8) & 0xFF;
+        const VirtualTexture &texture = virtualTextures.textures[id];
+        for (; level < texture.levelCount; level++, x /= 2, y /= 2)
+        {
+            uint32_t tile = virtualTileKey(id, level, x, y);
+            if (!visited.insert(tile).second)
+                break;
+            if (x >= virtualTilesWide(texture, level) || y >= virtualTilesHigh(texture, level))
+                continue;
+            auto resident = virtualTextures.residentTiles.find(tile);
+            if (resident != virtualTextures.residentTiles.end())
+                virtualTextures.slots[resident->second].lastUsed = virtualTextures.frame;
+            else if (!virtualTextures.loadingTiles.count(tile))
+                missing.push_back(tile);
+        }
+    }
+
+    // Only as many tiles as there are slots to put them in, or a cache too
+    // small for the view would read the same tiles from disk every frame.
+    size_t available = 0;
+    for (const VirtualTileSlot &slot : virtualTextures.slots)
+        if (slot.key == NO_VIRTUAL_TILE || (!slot.pinned && slot.lastUsed < virtualTextures.frame))
+            available++;
+    std::sort(missing.begin(), missing.end(), [](uint32_t a, uint32_t b) {
+        return ((a >> 16) & 0xFF) > ((b >> 16) & 0xFF);
+    });
+    size_t requests = std::min(MAX_VIRTUAL_TILE_REQUESTS, available);
+    requests = requests > virtualTextures.loadingTiles.size() ? requests - virtualTextures.loadingTiles.size() : 0;
+    for (size_t i = 0; i < missing.size() && i < requests; i++)
+        requestVirtualTile(missing[i], false);
+}
+
+// Starts reading this frame's feedback back and processes last frame's.
+void endVirtualTextureFeedback()
+{
+    size_t pixelCount = static_cast<size_t>(virtualTextures.feedbackWidth) * virtualTextures.feedbackHeight;
+    unsigned int current = virtualTextures.feedbackBuffers[virtualTextures.frame % 2];
+    unsigned int previous = virtualTextures.feedbackBuffers[(virtualTextures.frame + 1) % 2];
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, current);
+    glReadPixels(0, 0, virtualTextures.feedbackWidth, virtualTextures.feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    virtualTextures.frame++;
+    if (virtualTextures.frame > 1)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, previous);
+        const unsigned char *pixels = static_cast<const unsigned char *>(
+            glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixelCount * 4, GL_MAP_READ_BIT));
+        if (pixels)
+        {
+            processVirtualTextureFeedback(pixels, pixelCount);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void destroyVirtualTextures()
+{
+    for (VirtualTexture &texture : virtualTextures.textures)
+        glDeleteTextures(1, &texture.pageTable);
+    if (virtualTextures.physicalCache)
+    {
+        glDeleteTextures(1, &virtualTextures.physicalCache);
+        glDeleteTextures(1, &virtualTextures.feedbackColor);
+        glDeleteRenderbuffers(1, &virtualTextures.feedbackDepth);
+        glDeleteFramebuffers(1, &virtualTextures.feedbackFBO);
+        glDeleteBuffers(2, virtualTextures.feedbackBuffers);
+    }
+    virtualTextures = VirtualTextureSystem();
+}
+
+void reportVirtualTextures()
+{
+    if (virtualTextures.textures.empty())
+        return;
+    size_t side = static_cast<size_t>(virtualTextures.cacheTilesPerSide) * VIRTUAL_TILE_SPAN;
+    std::cout << "Virtual textures: " << virtualTextures.residentTiles.size() << " of " << virtualTextures.slots.size()
+              << " cache tiles in use (" << side * side * 4 / 1024 << " KB), " << virtualTextures.tilesLoaded
+              << " tiles loaded, " << virtualTextures.tilesEvicted << " evicted" << std::endl;
+}
+
+// Render-thread half of a shared-context upload: once an upload's fence has
+// signalled, give meshes their VAO and publish the asset. Never blocks; an
+// unsignalled fence is simply checked again next frame.
+void publishFencedUploads()
+{
+    AssetUpload uploaded;
+    while (mpscPop(loader.uploaded, uploaded))
+        loader.uploads.push_back(std::move(uploaded));
+
+    for (size_t i = 0; i < loader.uploads.size();)
+    {
+        AssetUpload &upload = loader.uploads[i];
+        if (upload.fence)
+        {
+            GLenum status = glClientWaitSync(upload.fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+            {
+                i++;
+                continue;
+            }
+            glDeleteSync(upload.fence);
+            upload.fence = nullptr;
+        }
+
+        if (upload.job.kind == AssetKind::TextureLevel)
+        {
+            finishLevelUpload(upload);
+            loader.uploads.erase(loader.uploads.begin() + i);
+            continue;
+        }
+        if (upload.job.kind == AssetKind::VirtualTile)
+        {
+            finishVirtualTileUpload(upload);
+            loader.uploads.erase(loader.uploads.begin() + i);
+            continue;
+        }
+        if (upload.job.kind == AssetKind::VirtualTextureCache)
+        {
+            finishVirtualTextureBuild(upload);
+            loader.uploads.erase(loader.uploads.begin() + i);
+            continue;
+        }
+
+        // The upload thread cannot see the registry, so duplicates are
+        // only caught here, after their upload.
+        bool duplicate = duplicatesResidentAsset(upload);
+        if (upload.job.kind == AssetKind::Mesh && !upload.failed && !duplicate &&
+            assetSlotCurrent(assets.meshes, upload.job))
+        {
+            Model &model = upload.mesh.model;
+            glGenVertexArrays(1, &model.VAO);
+            glBindVertexArray(model.VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, model.VBO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.EBO);
+            setVertexAttributes(vertexLayout);
+            glBindVertexArray(0);
+        }
+        finishAssetUpload(upload, duplicate);
+        loader.uploads.erase(loader.uploads.begin() + i);
+    }
+}
+
+// Called once per frame on the GL thread. With an upload context this only
+// publishes fenced uploads; otherwise it collects decoded assets and uploads
+// at most `budget` bytes of them (a single texture row may exceed it). An
+// asset whose content matches one already resident is not uploaded again.
+void pumpAssetUploads(size_t budget)
+{
+    if (loader.uploadWindow)
+    {
+        publishFencedUploads();
+        return;
+    }
+
+    AssetUpload decoded;
+    while (mpscPop(loader.decoded, decoded))
+        loader.uploads.push_back(std::move(decoded));
+
+    size_t spent = 0;
+    while (!loader.uploads.empty() && spent < budget)
+    {
+        AssetUpload &upload = loader.uploads.front();
+        if (upload.job.kind == AssetKind::TextureLevel)
+        {
+            if (!upload.failed && !streamedTextureOrphaned(upload.job.level.texture))
+            {
+                spent += continueLevelUpload(upload, budget - spent);
+                if (!levelUploadDone(upload))
+                    continue;
+            }
+            finishLevelUpload(upload);
+            loader.uploads.pop_front();
+            continue;
+        }
+        if (upload.job.kind == AssetKind::VirtualTile)
+        {
+            finishVirtualTileUpload(upload);
+            spent += upload.levelData.size();
+            loader.uploads.pop_front();
+            continue;
+        }
+        if (upload.job.kind == AssetKind::VirtualTextureCache)
+        {
+            finishVirtualTextureBuild(upload);
+            loader.uploads.pop_front();
+            continue;
+        }
+
+        bool isMesh = upload.job.kind == AssetKind::Mesh;
+        bool current = isMesh ? assetSlotCurrent(assets.meshes, upload.job)
+                              : assetSlotCurrent(assets.textures, upload.job);
+        bool duplicate = !upload.started && duplicatesResidentAsset(upload);
+
+        if (current && !upload.failed && !duplicate)
+        {
+            spent += isMesh ? continueMeshUpload(upload, budget - spent) : continueTextureUpload(upload, budget - spent);
+            if (!assetUploadDone(upload))
+                continue;
+        }
+
+        finishAssetUpload(upload, duplicate);
+        loader.uploads.pop_front();
+    }
+}
+
+Renderable loadRenderable(const char *objPath, const char *texturePath)
+{
+    Renderable renderable;
+    if (useVirtualTextures)
+        renderable.virtualTexture = loadVirtualTexture(texturePath);
+    if (renderable.virtualTexture >= 0)
+    {
+        renderable.mesh = asyncLoading ? acquireAssetAsync(assets.meshes, objPath, AssetKind::Mesh, loader.placeholderMesh)
+                                       : acquireAsset(assets.meshes, objPath, loadOBJ, meshContentHash);
+        return renderable;
+    }
+    if (asyncLoading)
+    {
+        renderable.mesh = acquireAssetAsync(assets.meshes, objPath, AssetKind::Mesh, loader.placeholderMesh);
+        renderable.texture = acquireAssetAsync(assets.textures, texturePath, AssetKind::Texture,
+                                               loader.placeholderTexture);
+        return renderable;
+    }
+    renderable.mesh = acquireAsset(assets.meshes, objPath, loadOBJ, meshContentHash);
+    renderable.texture = acquireAsset(assets.textures, texturePath, loadTexture, textureContentHash);
+    return renderable;
+}
+
+void releaseRenderable(Renderable &renderable)
+{
+    releaseAsset(assets.meshes, renderable.mesh, destroyModel);
+    releaseAsset(assets.textures, renderable.texture, destroyTexture);
+    renderable = Renderable();
+}
+
+// Set with --no-shadows to skip the shadow pass and shadow lookups.
+bool renderShadows = true;
+
+// Constant uniforms of a new scene shader variant.
+void initializeSceneShader(const ShaderProgram &program)
+{
+    setUniform(program, UNIFORM_TEXTURE1, 0);
+    setUniform(program, UNIFORM_SHADOW_MAP, 1);
+    setUniform(program, UNIFORM_PAGE_TABLE, 2);
+    setUniform(program, UNIFORM_PHYSICAL_CACHE, 3);
+    setUniform(program, UNIFORM_OBJECT_COLOR, glm::vec3(1.0f, 0.5f, 0.31f));
+    float side = static_cast<float>(virtualTextures.cacheTilesPerSide * VIRTUAL_TILE_SPAN);
+    setUniform(program, UNIFORM_PHYSICAL_CACHE_SIZE, glm::vec2(side, side));
+}
+
+glm::mat3 normalMatrix(const glm::mat4 &model)
+{
+    return glm::transpose(glm::inverse(glm::mat3(model)));
+}
+
+// Per-object translation, rotation (unit quaternion) and scale, one stream
+// per component, for composing many model matrices at once.
+struct TransformStreams {
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+    std::vector<float> scaleX, scaleY, scaleZ;
+
+    size_t size() const { return positionX.size(); }
+};
+
+// The scalar reference composeTransforms must match.
+glm::mat4 composeTransform(glm::vec3 position, glm::quat rotation, glm::vec3 size)
+{
+    return glm::translate(glm::mat4(1.0f), position) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), size);
+}
+
+#ifdef TRANSFORM_USE_SSE
+// x, y, z, w hold one matrix column of four objects, an object per lane;
+// the transpose turns them into each object's column.
+inline void storeTransformColumn(__m128 x, __m128 y, __m128 z, __m128 w, float *matrices, int column)
+{
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(matrices + column * 4, x);
+    _mm_storeu_ps(matrices + 16 + column * 4, y);
+    _mm_storeu_ps(matrices + 32 + column * 4, z);
+    _mm_storeu_ps(matrices + 48 + column * 4, w);
+}
+#endif
+
+#ifdef TRANSFORM_USE_AVX
+inline void storeTransformColumn(__m256 x, __m256 y, __m256 z, __m256 w, float *matrices, int column)
+{
+    storeTransformColumn(_mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z),
+                         _mm256_castps256_ps128(w), matrices, column);
+    storeTransformColumn(_mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1),
+                         _mm256_extractf128_ps(w, 1), matrices + 64, column);
+}
+#endif
+
+// Writes count column-major mat4s, 64 bytes each, starting with object
+// first. matrices can be a mapped buffer: it is only written, in order.
+// Eight objects go through at once with AVX, four with SSE, and what is
+// left through composeTransform.
+void composeTransforms(const TransformStreams &streams, size_t first, size_t count, float *matrices)
+{
+    size_t i = 0;
+#if defined(TRANSFORM_USE_AVX)
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    for (; i + 8 <= count; i += 8)
+    {
+        size_t o = first + i;
+        __m256 qx = _mm256_loadu_ps(&streams.rotationX[o]), qy = _mm256_loadu_ps(&streams.rotationY[o]);
+        __m256 qz = _mm256_loadu_ps(&streams.rotationZ[o]), qw = _mm256_loadu_ps(&streams.rotationW[o]);
+        __m256 x2 = _mm256_add_ps(qx, qx), y2 = _mm256_add_ps(qy, qy), z2 = _mm256_add_ps(qz, qz);
+        __m256 xx = _mm256_mul_ps(qx, x2), yy = _mm256_mul_ps(qy, y2), zz = _mm256_mul_ps(qz, z2);
+        __m256 xy = _mm256_mul_ps(qx, y2), xz = _mm256_mul_ps(qx, z2), yz = _mm256_mul_ps(qy, z2);
+        __m256 wx = _mm256_mul_ps(qw, x2), wy = _mm256_mul_ps(qw, y2), wz = _mm256_mul_ps(qw, z2);
+        __m256 sx = _mm256_loadu_ps(&streams.scaleX[o]), sy = _mm256_loadu_ps(&streams.scaleY[o]);
+        __m256 sz = _mm256_loadu_ps(&streams.scaleZ[o]);
+
+        float *out = matrices + i * 16;
+        storeTransformColumn(_mm256_mul_ps(sx, _mm256_sub_ps(one, _mm256_add_ps(yy, zz))),
+                             _mm256_mul_ps(sx, _mm256_add_ps(xy, wz)),
+                             _mm256_mul_ps(sx, _mm256_sub_ps(xz, wy)), zero, out, 0);
+        storeTransformColumn(_mm256_mul_ps(sy, _mm256_sub_ps(xy, wz)),
+                             _mm256_mul_ps(sy, _mm256_sub_ps(one, _mm256_add_ps(xx, zz))),
+                             _mm256_mul_ps(sy, _mm256_add_ps(yz, wx)), zero, out, 1);
+        storeTransformColumn(_mm256_mul_ps(sz, _mm256_add_ps(xz, wy)),
+                             _mm256_mul_ps(sz, _mm256_sub_ps(yz, wx)),
+                             _mm256_mul_ps(sz, _mm256_sub_ps(one, _mm256_add_ps(xx, yy))), zero, out, 2);
+        storeTransformColumn(_mm256_loadu_ps(&streams.positionX[o]), _mm256_loadu_ps(&streams.positionY[o]),
+                             _mm256_loadu_ps(&streams.positionZ[o]), one, out, 3);
+    }
+#elif defined(TRANSFORM_USE_SSE)
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= count; i += 4)
+    {
+        size_t o = first + i;
+        __m128 qx = _mm_loadu_ps(&streams.rotationX[o]), qy = _mm_loadu_ps(&streams.rotationY[o]);
+        __m128 qz = _mm_loadu_ps(&streams.rotationZ[o]), qw = _mm_loadu_ps(&streams.rotationW[o]);
+        __m128 x2 = _mm_add_ps(qx, qx), y2 = _mm_add_ps(qy, qy), z2 = _mm_add_ps(qz, qz);
+        __m128 xx = _mm_mul_ps(qx, x2), yy = _mm_mul_ps(qy, y2), zz = _mm_mul_ps(qz, z2);
+        __m128 xy = _mm_mul_ps(qx, y2), xz = _mm_mul_ps(qx, z2), yz = _mm_mul_ps(qy, z2);
+        __m128 wx = _mm_mul_ps(qw, x2), wy = _mm_mul_ps(qw, y2), wz = _mm_mul_ps(qw, z2);
+        __m128 sx = _mm_loadu_ps(&streams.scaleX[o]), sy = _mm_loadu_ps(&streams.scaleY[o]);
+        __m128 sz = _mm_loadu_ps(&streams.scaleZ[o]);
+
+        float *out = matrices + i * 16;
+        storeTransformColumn(_mm_mul_ps(sx, _mm_sub_ps(one, _mm_add_ps(yy, zz))),
+                             _mm_mul_ps(sx, _mm_add_ps(xy, wz)),
+                             _mm_mul_ps(sx, _mm_sub_ps(xz, wy)), zero, out, 0);
+        storeTransformColumn(_mm_mul_ps(sy, _mm_sub_ps(xy, wz)),
+                             _mm_mul_ps(sy, _mm_sub_ps(one, _mm_add_ps(xx, zz))),
+                             _mm_mul_ps(sy, _mm_add_ps(yz, wx)), zero, out, 1);
+        storeTransformColumn(_mm_mul_ps(sz, _mm_add_ps(xz, wy)),
+                             _mm_mul_ps(sz, _mm_sub_ps(yz, wx)),
+                             _mm_mul_ps(sz, _mm_sub_ps(one, _mm_add_ps(xx, yy))), zero, out, 2);
+        storeTransformColumn(_mm_loadu_ps(&streams.positionX[o]), _mm_loadu_ps(&streams.positionY[o]),
+                             _mm_loadu_ps(&streams.positionZ[o]), one, out, 3);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        size_t o = first + i;
+        glm::mat4 model = composeTransform(
+            glm::vec3(streams.positionX[o], streams.positionY[o], streams.positionZ[o]),
+            glm::quat(streams.rotationW[o], streams.rotationX[o], streams.rotationY[o], streams.rotationZ[o]),
+            glm::vec3(streams.scaleX[o], streams.scaleY[o], streams.scaleZ[o]));
+        memcpy(matrices + i * 16, glm::value_ptr(model), sizeof(model));
+    }
+}
+
+// Scene contents live in an entity store. An archetype holds every entity
+// with one exact set of components, each component in its own packed
+// array indexed by row, so the systems below walk contiguous memory and
+// skip archetypes that lack what they need.
+const uint32_t COMPONENT_TRANSFORM = 1u << 0;
+const uint32_t COMPONENT_MESH = 1u << 1;
+const uint32_t COMPONENT_MATERIAL = 1u << 2;
+const uint32_t COMPONENT_BOUNDS = 1u << 3;
+const uint32_t COMPONENT_CASTS_SHADOW = 1u << 4;
+const uint32_t COMPONENT_PARENT = 1u << 5;
+
+const uint32_t NO_ENTITY = 0xffffffffu;
+
+const uint32_t RENDERABLE_COMPONENTS = COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_MATERIAL | COMPONENT_BOUNDS;
+
+struct MaterialRef {
+    TextureHandle texture;
+    int virtualTexture = -1;
+};
+
+// Bounds are unknown until the mesh has loaded (the loader's placeholder
+// does not count); the transform system then copies them from the Model,
+// again whenever the mesh pool's assets change, and keeps world-space
+// center and extent current. Entities with unknown bounds are never culled.
+// With a Parent, the transform streams are local to the parent entity and
+// local caches their matrix; world is always the entity's own. changedFrame
+// is the update that last changed world, which is how a change reaches
+// the children.
+struct Archetype {
+    uint32_t components = 0;
+    std::vector<uint32_t> entities;
+
+    TransformStreams transforms;
+    std::vector<uint8_t> dirty;
+    std::vector<uint8_t> uniformScale;
+    std::vector<glm::mat4> world;
+    std::vector<glm::mat3> normal;
+    std::vector<uint64_t> changedFrame;
+
+    std::vector<uint32_t> parents;
+    std::vector<glm::mat4> local;
+
+    std::vector<MeshHandle> meshes;
+    std::vector<MaterialRef> materials;
+
+    std::vector<uint8_t> boundsKnown;
+    std::vector<glm::vec3> localMin, localMax;
+    std::vector<glm::vec3> worldCenter, worldExtent;
+    // assets.meshes.assetVersion the bounds were last read at.
+    uint64_t boundsVersion = UINT64_MAX;
+};
+
+struct EntityLocation {
+    uint32_t archetype;
+    uint32_t row;
+};
+
+struct EntityStats {
+    uint64_t frames = 0;
+    uint64_t transforms = 0;
+    uint64_t culled = 0;
+    uint64_t draws = 0;
+    uint64_t instancedDraws = 0;
+    uint64_t reportedFrames = 0;
+    uint64_t reportedTransforms = 0;
+    uint64_t reportedCulled = 0;
+    uint64_t reportedDraws = 0;
+    uint64_t reportedInstancedDraws = 0;
+};
+
+// parented lists the entities with a parent set, in ascending id order.
+// A parent always has a lower id than its children, so that is also an
+// order in which every parent comes before its children.
+struct EntityStore {
+    std::vector<Archetype> archetypes;
+    std::vector<EntityLocation> locations;
+    std::vector<uint32_t> parented;
+    EntityStats stats;
+};
+
+uint32_t findArchetype(EntityStore &store, uint32_t components)
+{
+    for (size_t i = 0; i < store.archetypes.size(); i++)
+    {
+        if (store.archetypes[i].components == components)
+            return static_cast<uint32_t>(i);
+    }
+    Archetype archetype;
+    archetype.components = components;
+    store.archetypes.push_back(std::move(archetype));
+    return static_cast<uint32_t>(store.archetypes.size()) - 1;
+}
+
+// Appends a row with default component values; the setters below fill it.
+uint32_t createEntity(EntityStore &store, uint32_t components)
+{
+    uint32_t index = findArchetype(store, components);
+    Archetype &archetype = store.archetypes[index];
+    uint32_t entity = static_cast<uint32_t>(store.locations.size());
+    store.locations.push_back({index, static_cast<uint32_t>(archetype.entities.size())});
+    archetype.entities.push_back(entity);
+
+    if (components & COMPONENT_TRANSFORM)
+    {
+        TransformStreams &t = archetype.transforms;
+        for (std::vector<float> *stream : {&t.positionX, &t.positionY, &t.positionZ, &t.rotationX, &t.rotationY,
+                                           &t.rotationZ})
+            stream->push_back(0.0f);
+        for (std::vector<float> *stream : {&t.rotationW, &t.scaleX, &t.scaleY, &t.scaleZ})
+            stream->push_back(1.0f);
+        archetype.dirty.push_back(1);
+        archetype.uniformScale.push_back(1);
+        archetype.world.push_back(glm::mat4(1.0f));
+        archetype.normal.push_back(glm::mat3(1.0f));
+        archetype.changedFrame.push_back(0);
+    }
+    if (components & COMPONENT_PARENT)
+    {
+        archetype.parents.push_back(NO_ENTITY);
+        archetype.local.push_back(glm::mat4(1.0f));
+    }
+    if (components & COMPONENT_MESH)
+        archetype.meshes.push_back(MeshHandle());
+    if (components & COMPONENT_MATERIAL)
+        archetype.materials.push_back(MaterialRef());
+    if (components & COMPONENT_BOUNDS)
+    {
+        archetype.boundsKnown.push_back(0);
+        archetype.localMin.push_back(glm::vec3(0.0f));
+        archetype.localMax.push_back(glm::vec3(0.0f));
+        archetype.worldCenter.push_back(glm::vec3(0.0f));
+        archetype.worldExtent.push_back(glm::vec3(0.0f));
+        archetype.boundsVersion = UINT64_MAX;
+    }
+    return entity;
+}
+
+void setEntityTransform(EntityStore &store, uint32_t entity, glm::vec3 position, glm::quat rotation, glm::vec3 size)
+{
+    EntityLocation location = store.locations[entity];
+    Archetype &archetype = store.archetypes[location.archetype];
+    TransformStreams &t = archetype.transforms;
+    t.positionX[location.row] = position.x;
+    t.positionY[location.row] = position.y;
+    t.positionZ[location.row] = position.z;
+    t.rotationX[location.row] = rotation.x;
+    t.rotationY[location.row] = rotation.y;
+    t.rotationZ[location.row] = rotation.z;
+    t.rotationW[location.row] = rotation.w;
+    t.scaleX[location.row] = size.x;
+    t.scaleY[location.row] = size.y;
+    t.scaleZ[location.row] = size.z;
+    archetype.dirty[location.row] = 1;
+}
+
+void setEntityPosition(EntityStore &store, uint32_t entity, glm::vec3 position)
+{
+    EntityLocation location = store.locations[entity];
+    Archetype &archetype = store.archetypes[location.archetype];
+    TransformStreams &t = archetype.transforms;
+    if (t.positionX[location.row] == position.x && t.positionY[location.row] == position.y &&
+        t.positionZ[location.row] == position.z)
+        return;
+    t.positionX[location.row] = position.x;
+    t.positionY[location.row] = position.y;
+    t.positionZ[location.row] = position.z;
+    archetype.dirty[location.row] = 1;
+}
+
+// Makes the entity's transform relative to parent. The entity needs the
+// Parent component and parent a transform; parent must have been created
+// first, which keeps the hierarchy free of cycles.
+bool setEntityParent(EntityStore &store, uint32_t entity, uint32_t parent)
+{
+    EntityLocation location = store.locations[entity];
+    Archetype &archetype = store.archetypes[location.archetype];
+    if (!(archetype.components & COMPONENT_PARENT) || parent >= entity ||
+        !(store.archetypes[store.locations[parent].archetype].components & COMPONENT_TRANSFORM))
+    {
+        std::cerr << "Cannot parent entity " << entity << " to " << parent << std::endl;
+        return false;
+    }
+    if (archetype.parents[location.row] == NO_ENTITY)
+        store.parented.insert(std::lower_bound(store.parented.begin(), store.parented.end(), entity), entity);
+    archetype.parents[location.row] = parent;
+    archetype.dirty[location.row] = 1;
+    return true;
+}
+
+// The rotation objectTransform applies for Euler angles in degrees.
+glm::quat eulerRotation(glm::vec3 degrees)
+{
+    return glm::angleAxis(glm::radians(degrees.x), glm::vec3(1.0f, 0.0f, 0.0f)) *
+           glm::angleAxis(glm::radians(degrees.y), glm::vec3(0.0f, 1.0f, 0.0f)) *
+           glm::angleAxis(glm::radians(degrees.z), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+uint32_t createRenderableEntity(EntityStore &store, uint32_t components, const Renderable &renderable,
+                                glm::vec3 position, glm::vec3 rotation, glm::vec3 size, uint32_t parent = NO_ENTITY)
+{
+    if (parent != NO_ENTITY)
+        components |= COMPONENT_PARENT;
+    uint32_t entity = createEntity(store, components | RENDERABLE_COMPONENTS);
+    if (parent != NO_ENTITY)
+        setEntityParent(store, entity, parent);
+    EntityLocation location = store.locations[entity];
+    Archetype &archetype = store.archetypes[location.archetype];
+    archetype.meshes[location.row] = renderable.mesh;
+    archetype.materials[location.row] = {renderable.texture, renderable.virtualTexture};
+    setEntityTransform(store, entity, position, eulerRotation(rotation), size);
+    return entity;
+}
+
+// Refreshes what follows from a row's new world matrix: the normal matrix
+// and the world-space AABB of the local bounds.
+void finishEntityTransform(Archetype &archetype, size_t row, bool uniformScale)
+{
+    const glm::mat4 &world = archetype.world[row];
+    archetype.uniformScale[row] = uniformScale;
+    if (!uniformScale)
+        archetype.normal[row] = normalMatrix(world);
+    if (archetype.components & COMPONENT_BOUNDS)
+    {
+        glm::vec3 center = 0.5f * (archetype.localMin[row] + archetype.localMax[row]);
+        glm::vec3 extent = 0.5f * (archetype.localMax[row] - archetype.localMin[row]);
+        glm::mat3 linear(world);
+        glm::mat3 absolute(glm::abs(linear[0]), glm::abs(linear[1]), glm::abs(linear[2]));
+        archetype.worldCenter[row] = glm::vec3(world * glm::vec4(center, 1.0f));
+        archetype.worldExtent[row] = absolute * extent;
+    }
+}
+
+bool rowScaleUniform(const TransformStreams &t, size_t row)
+{
+    return t.scaleX[row] == t.scaleY[row] && t.scaleY[row] == t.scaleZ[row];
+}
+
+// Composes the matrix of every dirty row, a contiguous run of dirty rows
+// at a time: the world matrix for entities without a parent, the local
+// one for the rest. Parented entities are then visited parents first and
+// recomposed when they or their parent changed this update, which carries
+// a change down the whole subtree. Rows whose mesh has just loaded pick up
+// its bounds first.
+void updateEntityTransforms(EntityStore &store)
+{
+    uint64_t frame = ++store.stats.frames;
+    for (Archetype &archetype : store.archetypes)
+    {
+        if (!(archetype.components & COMPONENT_TRANSFORM))
+            continue;
+        bool hasBounds = (archetype.components & COMPONENT_BOUNDS) && (archetype.components & COMPONENT_MESH);
+        bool hasParent = (archetype.components & COMPONENT_PARENT) != 0;
+        size_t rows = archetype.entities.size();
+        if (hasBounds && archetype.boundsVersion != assets.meshes.assetVersion)
+        {
+            for (size_t row = 0; row < rows; row++)
+            {
+                const Model *mesh = resolveLoadedAsset(assets.meshes, archetype.meshes[row]);
+                bool known = mesh != nullptr;
+                if (known == (archetype.boundsKnown[row] != 0) &&
+                    (!known || (archetype.localMin[row] == mesh->boundsMin && archetype.localMax[row] == mesh->boundsMax)))
+                    continue;
+                if (known)
+                {
+                    archetype.localMin[row] = mesh->boundsMin;
+                    archetype.localMax[row] = mesh->boundsMax;
+                }
+                archetype.boundsKnown[row] = known;
+                archetype.dirty[row] = 1;
+            }
+            archetype.boundsVersion = assets.meshes.assetVersion;
+        }
+
+        const TransformStreams &t = archetype.transforms;
+        std::vector<glm::mat4> &target = hasParent ? archetype.local : archetype.world;
+        for (size_t first = 0; first < rows;)
+        {
+            if (!archetype.dirty[first])
+            {
+                first++;
+                continue;
+            }
+            size_t end = first;
+            while (end < rows && archetype.dirty[end])
+                end++;
+            composeTransforms(t, first, end - first, glm::value_ptr(target[first]));
+            for (size_t row = first; row < end; row++)
+            {
+                archetype.changedFrame[row] = frame;
+                archetype.dirty[row] = 0;
+                if (hasParent && archetype.parents[row] != NO_ENTITY)
+                    continue;
+                if (hasParent)
+                    archetype.world[row] = archetype.local[row];
+                finishEntityTransform(archetype, row, rowScaleUniform(t, row));
+                store.stats.transforms++;
+            }
+            first = end;
+        }
+    }
+
+    for (uint32_t entity : store.parented)
+    {
+        EntityLocation location = store.locations[entity];
+        Archetype &archetype = store.archetypes[location.archetype];
+        EntityLocation parentLocation = store.locations[archetype.parents[location.row]];
+        const Archetype &parent = store.archetypes[parentLocation.archetype];
+        if (archetype.changedFrame[location.row] != frame && parent.changedFrame[parentLocation.row] != frame)
+            continue;
+        archetype.world[location.row] = parent.world[parentLocation.row] * archetype.local[location.row];
+        archetype.changedFrame[location.row] = frame;
+        // A non-uniform scale anywhere up the chain shears the children.
+        bool uniform = rowScaleUniform(archetype.transforms, location.row) && parent.uniformScale[parentLocation.row];
+        finishEntityTransform(archetype, location.row, uniform);
+        store.stats.transforms++;
+    }
+}
+
+// One visible renderable. The pointers refer into the store and stay
+// valid until the next entity is created.
+struct DrawItem {
+    Renderable renderable;
+    const glm::mat4 *world;
+    const glm::mat3 *normal;
+    bool uniformScale;
+};
+
+// Frustum planes of a view-projection matrix, normals pointing inwards.
+void frustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6])
+{
+    glm::mat4 m = glm::transpose(viewProjection);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        planes[axis * 2] = m[3] + m[axis];
+        planes[axis * 2 + 1] = m[3] - m[axis];
+    }
+}
+
+// Culls every renderable with all of the required components against the
+// frustum of viewProjection and lists the rest, sorted so draws sharing a
+// mesh and material sit next to each other.
+void buildDrawList(EntityStore &store, const glm::mat4 &viewProjection, uint32_t required,
+                   std::vector<DrawItem> &draws)
+{
+    glm::vec4 planes[6];
+    frustumPlanes(viewProjection, planes);
+    draws.clear();
+    required |= RENDERABLE_COMPONENTS;
+    for (const Archetype &archetype : store.archetypes)
+    {
+        if ((archetype.components & required) != required)
+            continue;
+        for (size_t row = 0; row < archetype.entities.size(); row++)
+        {
+            if (archetype.boundsKnown[row])
+            {
+                const glm::vec3 &center = archetype.worldCenter[row];
+                const glm::vec3 &extent = archetype.worldExtent[row];
+                bool outside = false;
+                for (const glm::vec4 &plane : planes)
+                {
+                    glm::vec3 normal(plane);
+                    if (glm::dot(normal, center) + plane.w + glm::dot(glm::abs(normal), extent) < 0.0f)
+                    {
+                        outside = true;
+                        break;
+                    }
+                }
+                if (outside)
+                {
+                    store.stats.culled++;
+                    continue;
+                }
+            }
+            const MaterialRef &material = archetype.materials[row];
+            DrawItem item;
+            item.renderable.mesh = archetype.meshes[row];
+            item.renderable.texture = material.texture;
+            item.renderable.virtualTexture = material.virtualTexture;
+            item.world = &archetype.world[row];
+            item.normal = &archetype.normal[row];
+            item.uniformScale = archetype.uniformScale[row] != 0;
+            draws.push_back(item);
+        }
+    }
+    auto key = [](const DrawItem &item)
+    {
+        return std::make_tuple(item.renderable.mesh.index, item.renderable.texture.index,
+                               item.renderable.virtualTexture, item.uniformScale);
+    };
+    std::stable_sort(draws.begin(), draws.end(),
+                     [&key](const DrawItem &a, const DrawItem &b) { return key(a) < key(b); });
+}
+
+void reportEntityStore(EntityStore &store)
+{
+    EntityStats &stats = store.stats;
+    double frames = static_cast<double>(std::max<uint64_t>(1, stats.frames - stats.reportedFrames));
+    std::cout << "Entities: " << store.locations.size() << " in " << store.archetypes.size() << " archetypes, per frame "
+              << (stats.transforms - stats.reportedTransforms) / frames << " transforms, "
+              << (stats.culled - stats.reportedCulled) / frames << " culled, "
+              << (stats.draws - stats.reportedDraws) / frames << " draws ("
+              << (stats.instancedDraws - stats.reportedInstancedDraws) / frames << " instanced)" << std::endl;
+    stats.reportedFrames = stats.frames;
+    stats.reportedTransforms = stats.transforms;
+    stats.reportedCulled = stats.culled;
+    stats.reportedDraws = stats.draws;
+    stats.reportedInstancedDraws = stats.instancedDraws;
+}
+
+// The features a fallback keeps: the ones that change which uniforms a
+// draw sets.
+uint32_t sceneShaderFallback(uint32_t features)
+{
+    return features & (SHADER_INSTANCED | SHADER_UNIFORM_SCALE);
+}
+
+// Submits the variants the scene can pick, fallbacks included, so they
+// compile together while assets load instead of one per first draw.
+void prewarmSceneShaders(ShaderVariantCache &shaders)
+{
+    uint32_t shadows = renderShadows ? SHADER_SHADOWS : 0;
+    for (uint32_t scale : {0u, SHADER_UNIFORM_SCALE})
+    {
+        requestShaderVariant(shaders, sceneShaderFallback(scale));
+        requestShaderVariant(shaders, shadows | scale);
+        requestShaderVariant(shaders, shadows | SHADER_TEXTURE | scale);
+        if (useVirtualTextures)
+            requestShaderVariant(shaders, shadows | SHADER_VIRTUAL_TEXTURE | scale);
+    }
+}
+
+// Picks the cheapest scene variant for a renderable, binds it and its
+// textures. Draws with no texture resident yet shade with objectColor, and
+// ones whose virtual texture is still being built use the placeholder.
+const ShaderProgram &useSceneShader(ShaderVariantCache &shaders, const Renderable &renderable,
+                                    const unsigned int *texture, uint32_t features)
+{
+    if (renderShadows)
+        features |= SHADER_SHADOWS;
+    bool virtualTexture = renderable.virtualTexture >= 0 && virtualTextureReady(renderable.virtualTexture);
+    if (renderable.virtualTexture >= 0 && !virtualTexture && loader.placeholderTexture)
+        texture = &loader.placeholderTexture;
+    if (virtualTexture)
+        features |= SHADER_VIRTUAL_TEXTURE;
+    else if (texture)
+        features |= SHADER_TEXTURE;
+    // Until the variant has linked, draw with the plain objectColor one,
+    // which keeps the uniforms renderObj sets.
+    const ShaderProgram *variant = findShaderVariant(shaders, features);
+    const ShaderProgram &program = variant ? *variant : getShaderVariant(shaders, sceneShaderFallback(features));
+    useShaderProgram(program);
+
+    if (virtualTexture)
+    {
+        setVirtualTextureUniforms(program, renderable.virtualTexture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, virtualTextures.textures[renderable.virtualTexture].pageTable);
+    }
+    else if (texture)
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, *texture);
+    }
+    return program;
+}
+
+// normal is only read for non-uniform scale.
+void renderObj(ShaderVariantCache &shaders, const Renderable &renderable,
+               const glm::mat4 &model, const glm::mat3 &normal, bool uniformScale)
+{
+    const Model *mesh = resolveAsset(assets.meshes, renderable.mesh);
+    if (!mesh)
+        return;
+    const unsigned int *texture = resolveAsset(assets.textures, renderable.texture);
+    const ShaderProgram &program = useSceneShader(shaders, renderable, texture, uniformScale ? SHADER_UNIFORM_SCALE : 0);
+    setUniform(program, UNIFORM_MODEL, model);
+    if (!uniformScale)
+        setUniform(program, UNIFORM_NORMAL_MATRIX, normal);
+    setUniform(program, UNIFORM_POSITION_SCALE, mesh->positionScale);
+    setUniform(program, UNIFORM_POSITION_OFFSET, mesh->positionOffset);
+    if (texture)
+        requestTextureDetail(*texture, *mesh, model);
+
+    glBindVertexArray(mesh->VAO);
+    glDrawElements(GL_TRIANGLES, mesh->indexCount, mesh->indexType, 0);
+}
+
+// Draws a run of items sharing mesh, material and scale kind through the
+// INSTANCED variant, MAX_SHADER_INSTANCES per draw call. The world and
+// normal matrices are the entity store's, gathered per batch for upload.
+void renderObjInstances(ShaderVariantCache &shaders, const DrawItem *items, size_t itemCount)
+{
+    const Renderable &renderable = items[0].renderable;
+    bool uniformScale = items[0].uniformScale;
+    const Model *mesh = resolveAsset(assets.meshes, renderable.mesh);
+    if (!mesh)
+        return;
+    const unsigned int *texture = resolveAsset(assets.textures, renderable.texture);
+    uint32_t features = SHADER_INSTANCED | (uniformScale ? SHADER_UNIFORM_SCALE : 0);
+    const ShaderProgram &program = useSceneShader(shaders, renderable, texture, features);
+    setUniform(program, UNIFORM_POSITION_SCALE, mesh->positionScale);
+    setUniform(program, UNIFORM_POSITION_OFFSET, mesh->positionOffset);
+    glBindVertexArray(mesh->VAO);
+
+    glm::mat4 models[MAX_SHADER_INSTANCES];
+    glm::mat3 normals[MAX_SHADER_INSTANCES];
+    for (size_t first = 0; first < itemCount; first += MAX_SHADER_INSTANCES)
+    {
+        int count = static_cast<int>(std::min(itemCount - first, static_cast<size_t>(MAX_SHADER_INSTANCES)));
+        for (int i = 0; i < count; i++)
+            models[i] = *items[first + i].world;
+        setUniformArray(program, UNIFORM_MODELS, models, count);
+        if (!uniformScale)
+        {
+            for (int i = 0; i < count; i++)
+                normals[i] = *items[first + i].normal;
+            setUniformArray(program, UNIFORM_NORMAL_MATRICES, normals, count);
+        }
+        // Any instance may be the one nearest the camera, so each reports
+        // the detail it needs.
+        if (texture)
+            for (int i = 0; i < count; i++)
+                requestTextureDetail(*texture, *mesh, models[i]);
+        glDrawElementsInstanced(GL_TRIANGLES, mesh->indexCount, mesh->indexType, 0, count);
+    }
+}
+
+// Draws a list from buildDrawList. Runs of items sharing mesh, material
+// and scale kind go through the INSTANCED variant as one batch.
+void renderDrawList(ShaderVariantCache &shaders, const std::vector<DrawItem> &draws, EntityStats &stats)
+{
+    for (size_t first = 0; first < draws.size();)
+    {
+        const DrawItem &item = draws[first];
+        size_t end = first + 1;
+        while (end < draws.size() && draws[end].renderable.mesh.index == item.renderable.mesh.index &&
+               draws[end].renderable.mesh.generation == item.renderable.mesh.generation &&
+               draws[end].renderable.texture.index == item.renderable.texture.index &&
+               draws[end].renderable.texture.generation == item.renderable.texture.generation &&
+               draws[end].renderable.virtualTexture == item.renderable.virtualTexture &&
+               draws[end].uniformScale == item.uniformScale)
+            end++;
+        if (end - first == 1)
+        {
+            renderObj(shaders, item.renderable, *item.world, *item.normal, item.uniformScale);
+            stats.draws++;
+        }
+        else
+        {
+            renderObjInstances(shaders, &draws[first], end - first);
+            size_t batches = (end - first + MAX_SHADER_INSTANCES - 1) / MAX_SHADER_INSTANCES;
+            stats.draws += batches;
+            stats.instancedDraws += batches;
+        }
+        first = end;
+    }
+}
+
+void renderObjDepth(const ShaderProgram &program, const Renderable &renderable, const glm::mat4 &model)
+{
+    const Model *mesh = resolveAsset(assets.meshes, renderable.mesh);
+    if (!mesh)
+        return;
+    setUniform(program, UNIFORM_MODEL, model);
+    setUniform(program, UNIFORM_POSITION_SCALE, mesh->positionScale);
+    setUniform(program, UNIFORM_POSITION_OFFSET, mesh->positionOffset);
+
+    glBindVertexArray(mesh->VAO);
+    glDrawElements(GL_TRIANGLES, mesh->indexCount, mesh->indexType, 0);
+}
+
+void renderObjFeedback(const ShaderProgram &program, const Renderable &renderable, const glm::mat4 &model)
+{
+    const Model *mesh = resolveAsset(assets.meshes, renderable.mesh);
+    if (!mesh)
+        return;
+    setUniform(program, UNIFORM_MODEL, model);
+    setUniform(program, UNIFORM_POSITION_SCALE, mesh->positionScale);
+    setUniform(program, UNIFORM_POSITION_OFFSET, mesh->positionOffset);
+    bool virtualTexture = renderable.virtualTexture >= 0 && virtualTextureReady(renderable.virtualTexture);
+    setUniform(program, UNIFORM_VIRTUAL_TEXTURE_ID, virtualTexture ? renderable.virtualTexture + 1 : 0);
+    if (virtualTexture)
+        setVirtualTextureUniforms(program, renderable.virtualTexture);
+
+    glBindVertexArray(mesh->VAO);
+    glDrawElements(GL_TRIANGLES, mesh->indexCount, mesh->indexType, 0);
+}
+
+bool sameObjResult(const tinyobj::attrib_t &a, const std::vector<tinyobj::shape_t> &aShapes,
+                   const tinyobj::attrib_t &b, const std::vector<tinyobj::shape_t> &bShapes)
+{
+    if (a.vertices != b.vertices || a.vertex_weights != b.vertex_weights || a.normals != b.normals ||
+        a.texcoords != b.texcoords || a.texcoord_ws != b.texcoord_ws || a.colors != b.colors ||
+        aShapes.size() != bShapes.size())
+        return false;
+
+    for (size_t i = 0; i < aShapes.size(); i++)
+    {
+        const tinyobj::mesh_t &am = aShapes[i].mesh;
+        const tinyobj::mesh_t &bm = bShapes[i].mesh;
+        if (aShapes[i].name != bShapes[i].name || am.indices.size() != bm.indices.size() ||
+            am.num_face_vertices != bm.num_face_vertices || am.material_ids != bm.material_ids ||
+            am.smoothing_group_ids != bm.smoothing_group_ids)
+            return false;
+        for (size_t j = 0; j < am.indices.size(); j++)
+        {
+            if (am.indices[j].vertex_index != bm.indices[j].vertex_index ||
+                am.indices[j].normal_index != bm.indices[j].normal_index ||
+                am.indices[j].texcoord_index != bm.indices[j].texcoord_index)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Rasterizes the mesh in index order from the six axis directions into a
+// small depth buffer, with depth testing and no face culling (as main()
+// renders). Returns shaded fragments (those passing the depth test) per
+// covered pixel; 1.0 means every pixel was shaded exactly once.
+float measureOverdraw(const MeshData &mesh)
+{
+    const int RESOLUTION = 256;
+    std::vector<float> depth(RESOLUTION * RESOLUTION);
+    size_t shaded = 0, covered = 0;
+
+    glm::vec3 extent = glm::max(mesh.boundsMax - mesh.boundsMin, glm::vec3(1e-6f));
+    float scale = (RESOLUTION - 1) / std::max(extent.x, std::max(extent.y, extent.z));
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int direction = 0; direction < 2; direction++)
+        {
+            std::fill(depth.begin(), depth.end(), 1e30f);
+            int uAxis = (axis + 1) % 3, vAxis = (axis + 2) % 3;
+            float depthSign = direction == 0 ? 1.0f : -1.0f;
+
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+            {
+                glm::vec3 p[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    glm::vec3 position = glm::make_vec3(&mesh.vertices[mesh.indices[i + k] * VERTEX_STRIDE]) - mesh.boundsMin;
+                    p[k] = glm::vec3(position[uAxis] * scale, position[vAxis] * scale, position[axis] * depthSign);
+                }
+
+                float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+                if (area == 0.0f)
+                    continue;
+
+                int minX = std::max(0, static_cast<int>(std::floor(std::min(p[0].x, std::min(p[1].x, p[2].x)))));
+                int maxX = std::min(RESOLUTION - 1, static_cast<int>(std::ceil(std::max(p[0].x, std::max(p[1].x, p[2].x)))));
+                int minY = std::max(0, static_cast<int>(std::floor(std::min(p[0].y, std::min(p[1].y, p[2].y)))));
+                int maxY = std::min(RESOLUTION - 1, static_cast<int>(std::ceil(std::max(p[0].y, std::max(p[1].y, p[2].y)))));
+
+                for (int y = minY; y <= maxY; y++)
+                {
+                    for (int x = minX; x <= maxX; x++)
+                    {
+                        float px = x + 0.5f, py = y + 0.5f;
+                        float w0 = ((p[2].x - p[1].x) * (py - p[1].y) - (p[2].y - p[1].y) * (px - p[1].x)) / area;
+                        float w1 = ((p[0].x - p[2].x) * (py - p[2].y) - (p[0].y - p[2].y) * (px - p[2].x)) / area;
+                        float w2 = 1.0f - w0 - w1;
+                        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                            continue;
+
+                        float z = w0 * p[0].z + w1 * p[1].z + w2 * p[2].z;
+                        float &stored = depth[y * RESOLUTION + x];
+                        if (z < stored)
+                        {
+                            if (stored == 1e30f)
+                                covered++;
+                            stored = z;
+                            shaded++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return covered ? static_cast<float>(shaded) / static_cast<float>(covered) : 0.0f;
+}
+
+// Usage: main --overdraw [file.obj ...]
+// Compares overdraw of the OBJ order, the vertex-cache order and the
+// cache + overdraw order, without creating a window.
+int benchmarkOverdraw(int argc, char **argv)
+{
+    std::vector<const char *> paths;
+    for (int i = 2; i < argc; i++)
+        paths.push_back(argv[i]);
+    if (paths.empty())
+        paths = {"assets/duck.obj", "assets/cube.obj"};
+
+    for (const char *path : paths)
+    {
+        MeshData mesh;
+        std::string warn, err;
+        if (!importObj(path, mesh, &warn, &err))
+        {
+            std::cerr << "Failed to load OBJ file: " << warn << err << std::endl;
+            return 1;
+        }
+
+        size_t vertexCount = mesh.vertices.size() / VERTEX_STRIDE;
+        float original = measureOverdraw(mesh);
+        optimizeVertexCache(mesh.indices, vertexCount);
+        float cacheOnly = measureOverdraw(mesh);
+        float cacheAcmr = analyzeVertexCache(mesh.indices, vertexCount, 16).acmr;
+        optimizeOverdraw(mesh.indices, mesh.vertices, OVERDRAW_THRESHOLD);
+        float optimized = measureOverdraw(mesh);
+        float optimizedAcmr = analyzeVertexCache(mesh.indices, vertexCount, 16).acmr;
+
+        std::cout << path << ": overdraw " << original << " (OBJ order), " << cacheOnly
+                  << " (cache order, ACMR " << cacheAcmr << "), " << optimized
+                  << " (cache + overdraw order, ACMR " << optimizedAcmr << ")" << std::endl;
+    }
+    return 0;
+}
+
+// Usage: main --bench-obj <file.obj> [runs]
+int benchmarkObjLoad(const char *path, int runs)
+{
+    double serialBest = 1e30, parallelBest = 1e30;
+    tinyobj::attrib_t serialAttrib, parallelAttrib;
+    std::vector<tinyobj::shape_t> serialShapes, parallelShapes;
+
+    for (int run = 0; run < runs; run++)
+    {
+        std::vector<tinyobj::material_t> materials;
+        std::string warn, err;
+
+        auto start = std::chrono::steady_clock::now();
+        if (!tinyobj::LoadObj(&serialAttrib, &serialShapes, &materials, &warn, &err, path))
+        {
+            std::cerr << "Failed to load OBJ file: " << warn << err << std::endl;
+            return 1;
+        }
+        auto middle = std::chrono::steady_clock::now();
+        loadObjParallel(path, &parallelAttrib, &parallelShapes, &warn, &err);
+        auto end = std::chrono::steady_clock::now();
+
+        serialBest = std::min(serialBest, std::chrono::duration<double, std::milli>(middle - start).count());
+        parallelBest = std::min(parallelBest, std::chrono::duration<double, std::milli>(end - middle).count());
+    }
+
+    bool same = sameObjResult(serialAttrib, serialShapes, parallelAttrib, parallelShapes);
+    std::cout << path << ": serial " << serialBest << " ms, parallel " << parallelBest << " ms ("
+              << serialBest / parallelBest << "x on " << std::thread::hardware_concurrency() << " threads), "
+              << (same ? "outputs match" : "OUTPUTS DIFFER") << std::endl;
+    return same ? 0 : 1;
+}
+
+// Collects every number token from the v/vn/vt lines of an OBJ file.
+void collectObjNumbers(const char *path, std::vector<std::string> &corpus)
+{
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.size() < 2 || line[0] != 'v')
+            continue;
+        size_t start = line.find_first_of(" \t");
+        while (start != std::string::npos)
+        {
+            start = line.find_first_not_of(" \t\r", start);
+            if (start == std::string::npos)
+                break;
+            size_t end = line.find_first_of(" \t\r", start);
+            corpus.push_back(line.substr(start, end == std::string::npos ? std::string::npos : end - start));
+            start = end;
+        }
+    }
+}
+
+// Usage: main --bench-float [file.obj ...]
+// Checks tinyobj's fast real parser against its classic digit loop on a
+// corpus of OBJ numbers and reports numbers per second for both.
+int benchmarkFloatParsing(int argc, char **argv)
+{
+    std::vector<std::string> corpus;
+    for (int i = 2; i < argc; i++)
+        collectObjNumbers(argv[i], corpus);
+
+    // Synthetic numbers in the shapes OBJ exporters actually write.
+    unsigned int seed = 12345;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed; };
+    const char *formats[] = {"%.6f", "%.4f", "%.9g", "%e", "%.3e", "%.0f", "%+.5f", "%.8f"};
+    char buffer[64];
+    for (int i = 0; i < 400000; i++)
+    {
+        double magnitude = std::pow(10.0, static_cast<int>(next() % 9) - 4);
+        double value = (static_cast<double>(next()) / 4294967295.0 - 0.5) * magnitude;
+        snprintf(buffer, sizeof(buffer), formats[next() % 8], value);
+        corpus.push_back(buffer);
+    }
+    corpus.push_back(".5");
+    corpus.push_back("-.25e1");
+    corpus.push_back("-0");
+    corpus.push_back("1e");
+    corpus.push_back("1e400");
+    corpus.push_back("1e-400");
+    corpus.push_back(".");
+
+    size_t floatMismatches = 0, doubleMismatches = 0;
+    for (const std::string &number : corpus)
+    {
+        double classic = 0.0, fast = 0.0;
+        bool classicOk = tinyobj::tryParseDoubleClassic(number.data(), number.data() + number.size(), &classic);
+        bool fastOk = tinyobj::tryParseDoubleFast(number.data(), number.data() + number.size(), &fast);
+        float classicFloat = static_cast<float>(classic), fastFloat = static_cast<float>(fast);
+        if (classicOk != fastOk || memcmp(&classicFloat, &fastFloat, sizeof(float)) != 0)
+        {
+            if (floatMismatches++ < 10)
+                std::cerr << "Mismatch on \"" << number << "\": " << classicFloat << " vs " << fastFloat << std::endl;
+        }
+        if (memcmp(&classic, &fast, sizeof(double)) != 0)
+            doubleMismatches++;
+    }
+
+    // Time over one contiguous buffer, the way numbers sit in a real file.
+    std::string text;
+    std::vector<size_t> offsets;
+    for (const std::string &number : corpus)
+    {
+        offsets.push_back(text.size());
+        text += number;
+        text += ' ';
+    }
+    offsets.push_back(text.size());
+
+    auto measure = [&text, &offsets](bool (*parse)(const char *, const char *, double *)) {
+        double best = 1e30, sink = 0.0;
+        for (int run = 0; run < 10; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i + 1 < offsets.size(); i++)
+            {
+                double value = 0.0;
+                parse(text.data() + offsets[i], text.data() + offsets[i + 1] - 1, &value);
+                sink += value;
+            }
+            auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double>(end - start).count());
+        }
+        if (sink == 1234.5)
+            std::cout << "";
+        return (offsets.size() - 1) / best;
+    };
+
+    double classicRate = measure(tinyobj::tryParseDoubleClassic);
+    double fastRate = measure(tinyobj::tryParseDoubleFast);
+    std::cout << corpus.size() << " numbers: classic " << classicRate / 1e6 << " M/s, fast "
+              << fastRate / 1e6 << " M/s (" << fastRate / classicRate << "x); "
+              << floatMismatches << " float mismatches, " << doubleMismatches
+              << " inputs differ before the float cast" << std::endl;
+    return floatMismatches == 0 ? 0 : 1;
+}
+
+// Times CPU mip chain generation with each filter against the driver's
+// glTexImage2D + glGenerateMipmap (to glFinish), best of 5 runs per image.
+int benchmarkMipGeneration(int argc, char **argv)
+{
+    const int RUNS = 5;
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *window = glfwCreateWindow(64, 64, "Mip Benchmark", NULL, NULL);
+    if (!window)
+    {
+        std::cerr << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cerr << "Failed to initialize GLAD" << std::endl;
+        return 1;
+    }
+    std::cout << "GL renderer: " << glGetString(GL_RENDERER) << ", "
+              << std::max(1u, std::thread::hardware_concurrency()) << " CPU threads" << std::endl;
+
+    std::vector<const char *> paths;
+    for (int i = 2; i < argc; i++)
+        paths.push_back(argv[i]);
+    if (paths.empty())
+        paths = {"assets/concrete.png", "assets/brick.png", "assets/duck.jpg"};
+
+    for (const char *path : paths)
+    {
+        int width, height, components;
+        unsigned char *pixels = stbi_load(path, &width, &height, &components, 0);
+        if (!pixels)
+        {
+            std::cerr << "Texture failed to load at path: " << path << std::endl;
+            continue;
+        }
+        std::cout << path << " (" << width << "x" << height << "x" << components << ")" << std::endl;
+
+        double best = 1e30;
+        GLenum format = textureFormat(components);
+        for (int run = 0; run < RUNS; run++)
+        {
+            unsigned int texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glFinish();
+            auto start = std::chrono::steady_clock::now();
+            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glFinish();
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            glDeleteTextures(1, &texture);
+        }
+        std::cout << "  glGenerateMipmap (incl. base upload): " << best << " ms" << std::endl;
+
+        const char *filterNames[] = {"box", "kaiser", "lanczos"};
+        for (int filter = 0; filter < 3; filter++)
+        {
+            for (int srgb = 0; srgb < 2; srgb++)
+            {
+                MipOptions options;
+                options.filter = static_cast<MipFilter>(filter);
+                options.srgb = srgb != 0;
+                best = 1e30;
+                for (int run = 0; run < RUNS; run++)
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    std::vector<std::vector<unsigned char>> levels = generateMipChain(pixels, width, height, components, options);
+                    best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                }
+                std::cout << "  CPU " << filterNames[filter] << (srgb ? " (sRGB)" : " (linear)") << ": " << best << " ms" << std::endl;
+            }
+        }
+        stbi_image_free(pixels);
+    }
+
+    glfwTerminate();
+    return 0;
+}
+
+// Times stbi_load of each image at full size and at the 1/2, 1/4 and 1/8
+// JPEG decode scales, best of 5 runs.
+int benchmarkJpegScaling(int argc, char **argv)
+{
+    const int RUNS = 5;
+    std::vector<const char *> paths;
+    for (int i = 2; i < argc; i++)
+        paths.push_back(argv[i]);
+    if (paths.empty())
+        paths = {"assets/duck.jpg"};
+
+    for (const char *path : paths)
+    {
+        std::cout << path << std::endl;
+        double fullTime = 0.0;
+        for (int scale = 1; scale <= 8; scale *= 2)
+        {
+            stbi_set_jpeg_scale_on_load(scale);
+            int width = 0, height = 0, components = 0;
+            double best = 1e30;
+            for (int run = 0; run < RUNS; run++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                unsigned char *pixels = stbi_load(path, &width, &height, &components, 0);
+                best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                if (!pixels)
+                {
+                    std::cerr << "Texture failed to load at path: " << path << std::endl;
+                    best = -1.0;
+                    break;
+                }
+                stbi_image_free(pixels);
+            }
+            if (best < 0.0)
+                break;
+            if (scale == 1)
+                fullTime = best;
+            std::cout << "  1/" << scale << ": " << width << "x" << height << " in " << best << " ms ("
+                      << 100.0 * best / fullTime << "% of full)" << std::endl;
+        }
+    }
+    stbi_set_jpeg_scale_on_load(1);
+    return 0;
+}
+
+// A model matrix from Euler angles in degrees, built one glm call at a
+// time: the way scene objects were placed before the entity store, kept as
+// the benchmark's baseline.
+glm::mat4 objectTransform(glm::vec3 position, glm::vec3 rotation, glm::vec3 size)
+{
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    model = glm::rotate(model, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+    return glm::scale(model, size);
+}
+
+// Times n animated model matrices: objectTransform per object, the glm
+// quaternion reference, and composeTransforms (what the entity store
+// runs), into memory and into a mapped GL buffer.
+int benchmarkTransforms(int argc, char **argv)
+{
+    const int RUNS = 5;
+    std::vector<size_t> counts;
+    for (int i = 2; i < argc; i++)
+        counts.push_back(static_cast<size_t>(std::max(1, atoi(argv[i]))));
+    if (counts.empty())
+        counts = {1000, 10000, 100000};
+
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *window = glfwCreateWindow(64, 64, "Transform Benchmark", NULL, NULL);
+    if (window)
+        glfwMakeContextCurrent(window);
+    bool mapBuffers = window && gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+    if (!mapBuffers)
+        std::cerr << "No GL context, skipping the mapped buffer runs" << std::endl;
+#if defined(TRANSFORM_USE_AVX)
+    std::cout << "composeTransforms: AVX, 8 objects per step" << std::endl;
+#elif defined(TRANSFORM_USE_SSE)
+    std::cout << "composeTransforms: SSE, 4 objects per step" << std::endl;
+#else
+    std::cout << "composeTransforms: scalar" << std::endl;
+#endif
+
+    unsigned int seed = 12345;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return static_cast<float>(seed) / 4294967295.0f; };
+    auto best = [](auto &&work)
+    {
+        double fastest = 1e30;
+        for (int run = 0; run < RUNS; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            work();
+            fastest = std::min(fastest, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return fastest;
+    };
+
+    for (size_t count : counts)
+    {
+        TransformStreams streams;
+        std::vector<glm::vec3> positions(count), rotations(count), sizes(count);
+        std::vector<glm::quat> quats(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            positions[i] = glm::vec3(next(), next(), next()) * 100.0f - 50.0f;
+            rotations[i] = glm::vec3(next(), next(), next()) * 360.0f;
+            sizes[i] = glm::vec3(next(), next(), next()) * 1.5f + 0.5f;
+            quats[i] = glm::normalize(glm::quat(rotations[i] * glm::radians(1.0f)));
+            streams.positionX.push_back(positions[i].x);
+            streams.positionY.push_back(positions[i].y);
+            streams.positionZ.push_back(positions[i].z);
+            streams.rotationX.push_back(quats[i].x);
+            streams.rotationY.push_back(quats[i].y);
+            streams.rotationZ.push_back(quats[i].z);
+            streams.rotationW.push_back(quats[i].w);
+            streams.scaleX.push_back(sizes[i].x);
+            streams.scaleY.push_back(sizes[i].y);
+            streams.scaleZ.push_back(sizes[i].z);
+        }
+
+        std::vector<glm::mat4> euler(count), reference(count);
+        std::vector<float> batched(count * 16);
+        double eulerTime = best([&]() {
+            for (size_t i = 0; i < count; i++)
+                euler[i] = objectTransform(positions[i], rotations[i], sizes[i]);
+        });
+        double referenceTime = best([&]() {
+            for (size_t i = 0; i < count; i++)
+                reference[i] = composeTransform(positions[i], quats[i], sizes[i]);
+        });
+        double batchedTime = best([&]() { composeTransforms(streams, 0, count, batched.data()); });
+
+        float maxError = 0.0f;
+        for (size_t i = 0; i < count; i++)
+        {
+            const float *expected = glm::value_ptr(reference[i]);
+            for (int k = 0; k < 16; k++)
+                maxError = std::max(maxError, std::fabs(expected[k] - batched[i * 16 + k]));
+        }
+
+        std::cout << count << " objects (ms, best of " << RUNS << ")" << std::endl;
+        std::cout << "  objectTransform (Euler):  " << eulerTime << std::endl;
+        std::cout << "  glm quaternion reference: " << referenceTime << std::endl;
+        std::cout << "  composeTransforms:        " << batchedTime << " (" << eulerTime / batchedTime
+                  << "x objectTransform, max error " << maxError << ")" << std::endl;
+
+        if (mapBuffers)
+        {
+            GLsizeiptr bytes = static_cast<GLsizeiptr>(count * sizeof(glm::mat4));
+            unsigned int buffer;
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            double mappedTime = best([&]() {
+                glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+                void *mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+                if (mapped)
+                {
+                    composeTransforms(streams, 0, count, static_cast<float *>(mapped));
+                    glUnmapBuffer(GL_ARRAY_BUFFER);
+                }
+            });
+            glDeleteBuffers(1, &buffer);
+            std::cout << "  composeTransforms into a mapped buffer (incl. map/unmap): " << mappedTime << std::endl;
+        }
+    }
+    glfwTerminate();
+    return 0;
+}
+
+// Builds the .texcache of each image ahead of time so the first run does
+// not pay for encoding. --bc7 applies to the images after it.
+int compressTextureFiles(int argc, char **argv)
+{
+    stbi_set_flip_vertically_on_load(true);
+    int failures = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bc7") == 0)
+        {
+            preferBC7 = true;
+            continue;
+        }
+        CompressedTexture texture;
+        std::string cachePath = std::string(argv[i]) + ".texcache";
+        if (openTextureCache(cachePath, argv[i], textureCacheFlags(), texture, false))
+            std::cout << cachePath << " is up to date" << std::endl;
+        else if (!loadCompressedTexture(argv[i], texture))
+        {
+            std::cerr << "Texture failed to load at path: " << argv[i] << std::endl;
+            failures++;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// Writes every shader stage the renderer can compile, defines expanded, as
+// <dir>/<stage name> for tools/optimize_shaders.sh. Always the embedded
+// text, so re-running the pipeline never optimizes its own output.
+int exportShaders(const char *directory)
+{
+    struct ExportedStage {
+        const char *family;
+        const char *body;
+        uint32_t features;
+        const char *stage;
+    };
+    std::vector<ExportedStage> stages;
+    for (uint32_t features = 0; features < (SHADER_INSTANCED << 1); features++)
+    {
+        if ((features & SHADER_TEXTURE) && (features & SHADER_VIRTUAL_TEXTURE))
+            continue;
+        stages.push_back({"scene", vertexShaderSource, features, "vert"});
+        stages.push_back({"scene", fragmentShaderSource, features, "frag"});
+    }
+    stages.push_back({"depth", depthVertexShaderSource, 0, "vert"});
+    stages.push_back({"depth", depthFragmentShaderSource, 0, "frag"});
+    stages.push_back({"feedback", feedbackFragmentShaderSource, 0, "frag"});
+
+    std::filesystem::path dir = directory;
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    for (const ExportedStage &stage : stages)
+    {
+        std::filesystem::path path = dir / shaderStageName(stage.family, stage.features, stage.stage);
+        std::ofstream file(path, std::ios::binary);
+        file << buildShaderSource(stage.body, stage.features);
+        if (!file)
+        {
+            std::cerr << "Failed to write " << path.string() << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "Exported " << stages.size() << " shader stages to " << dir.string() << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "--bench-obj") == 0)
+        return benchmarkObjLoad(argv[2], argc >= 4 ? std::max(1, atoi(argv[3])) : 5);
+    if (argc >= 2 && strcmp(argv[1], "--bench-float") == 0)
+        return benchmarkFloatParsing(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "--overdraw") == 0)
+        return benchmarkOverdraw(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "--compress-textures") == 0)
+        return compressTextureFiles(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "--bench-mips") == 0)
+        return benchmarkMipGeneration(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "--bench-jpeg-scale") == 0)
+        return benchmarkJpegScaling(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "--bench-trs") == 0)
+        return benchmarkTransforms(argc, argv);
+    if (argc >= 3 && strcmp(argv[1], "--export-shaders") == 0)
+        return exportShaders(argv[2]);
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--streaming-import") == 0)
+            objImportMode = ObjImportMode::Streaming;
+        else if (strcmp(argv[i], "--no-mesh-optimize") == 0)
+            optimizeMeshes = false;
+        else if (strcmp(argv[i], "--float-vertices") == 0)
+            vertexLayout = FLOAT_VERTEX_LAYOUT;
+        else if (strcmp(argv[i], "--position-format") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "float") == 0)
+                vertexLayout.position = PositionEncoding::Float32;
+            else if (strcmp(argv[i], "unorm16") == 0)
+                vertexLayout.position = PositionEncoding::Unorm16;
+            else
+            {
+                std::cerr << "Unknown --position-format " << argv[i] << ", expected float or unorm16" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--normal-format") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "float") == 0)
+                vertexLayout.normal = NormalEncoding::Float32;
+            else if (strcmp(argv[i], "snorm10") == 0)
+                vertexLayout.normal = NormalEncoding::Snorm10;
+            else
+            {
+                std::cerr << "Unknown --normal-format " << argv[i] << ", expected float or snorm10" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--texcoord-format") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "float") == 0)
+                vertexLayout.texcoord = TexcoordEncoding::Float32;
+            else if (strcmp(argv[i], "half") == 0)
+                vertexLayout.texcoord = TexcoordEncoding::Half16;
+            else
+            {
+                std::cerr << "Unknown --texcoord-format " << argv[i] << ", expected float or half" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--sync-load") == 0)
+            asyncLoading = false;
+        else if (strcmp(argv[i], "--render-thread-uploads") == 0)
+            useUploadContext = false;
+        else if (strcmp(argv[i], "--uncompressed-textures") == 0)
+            compressTextures = false;
+        else if (strcmp(argv[i], "--bc7") == 0)
+            preferBC7 = true;
+        else if (strcmp(argv[i], "--virtual-textures") == 0)
+            useVirtualTextures = true;
+        else if (strcmp(argv[i], "--no-shadows") == 0)
+            renderShadows = false;
+        else if (strcmp(argv[i], "--no-program-cache") == 0)
+            programCache.enabled = false;
+        else if (strcmp(argv[i], "--optimized-shaders") == 0)
+            useOptimizedShaders = true;
+        else if (strcmp(argv[i], "--sync-shader-compile") == 0)
+            asyncShaderCompile = false;
+        else if (strcmp(argv[i], "--no-texture-streaming") == 0)
+            textureStreaming = false;
+        else if (strcmp(argv[i], "--gl-mipmaps") == 0)
+            generateMipsOnCpu = false;
+        else if (strcmp(argv[i], "--mip-linear") == 0)
+            mipOptions.srgb = false;
+        else if (strcmp(argv[i], "--mip-alpha-coverage") == 0)
+            mipOptions.alphaCutoff = 0.5f;
+        else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "box") == 0)
+                mipOptions.filter = MipFilter::Box;
+            else if (strcmp(argv[i], "lanczos") == 0)
+                mipOptions.filter = MipFilter::Lanczos;
+            else
+                mipOptions.filter = MipFilter::Kaiser;
+        }
+        else if (strcmp(argv[i], "--texture-scale") == 0 && i + 1 < argc)
+            textureDecodeScale = std::min(std::max(1, atoi(argv[++i])), 8);
+        else if (strcmp(argv[i], "--upload-budget-kb") == 0 && i + 1 < argc)
+            uploadBudgetBytes = std::max(1, atoi(argv[++i])) * size_t(1024);
+        else if (strcmp(argv[i], "--texture-budget-mb") == 0 && i + 1 < argc)
+            textureStreamer.budgetBytes = std::max(1, atoi(argv[++i])) * size_t(1024 * 1024);
+        else if (strcmp(argv[i], "--virtual-cache-tiles") == 0 && i + 1 < argc)
+            virtualTextures.cacheTilesPerSide = std::min(std::max(2, atoi(argv[++i])), 255);
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    
+    GLFWwindow* window = glfwCreateWindow(800, 600, "Rendering Test", NULL, NULL);
+    if (!window)
+    {
+        std::cerr << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
         std::cerr << "Failed to initialize GLAD" << std::endl;
@@ -342,12 +7437,27 @@ int main()
     
     glEnable(GL_DEPTH_TEST);
     stbi_set_flip_vertically_on_load(true);
+    detectTextureCompression();
+    detectProgramBinarySupport();
+    detectParallelShaderCompile();
 
-    unsigned int finalShaderProgram = createShaderProgram(vertexShaderSource, fragmentShaderSource);
-    unsigned int depthShaderProgram = createShaderProgram(depthVertexShaderSource, depthFragmentShaderSource);
-    
-    glUseProgram(finalShaderProgram);
-    glUniform1i(glGetUniformLocation(finalShaderProgram, "texture1"), 0);
+    ShaderVariantCache sceneShaders;
+    sceneShaders.name = "scene";
+    sceneShaders.vertexSource = vertexShaderSource;
+    sceneShaders.fragmentSource = fragmentShaderSource;
+    sceneShaders.initialize = initializeSceneShader;
+    prewarmSceneShaders(sceneShaders);
+    std::string depthVertex = shaderStageSource("depth", depthVertexShaderSource, 0, "vert");
+    std::string depthFragment = shaderStageSource("depth", depthFragmentShaderSource, 0, "frag");
+    ShaderProgram depthShaderProgram = createReflectedProgram(depthVertex.c_str(), depthFragment.c_str());
+    ShaderProgram feedbackShaderProgram;
+    if (useVirtualTextures)
+    {
+        // Only TexCoord matters to the feedback pass, so the cheapest vertex variant does.
+        std::string feedbackVertex = shaderStageSource("scene", vertexShaderSource, SHADER_UNIFORM_SCALE, "vert");
+        std::string feedbackFragment = shaderStageSource("feedback", feedbackFragmentShaderSource, 0, "frag");
+        feedbackShaderProgram = createReflectedProgram(feedbackVertex.c_str(), feedbackFragment.c_str());
+    }
     
     const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
     unsigned int depthMapFBO;
@@ -376,6 +7486,8 @@ int main()
                                  glm::vec3(0.0f, 0.0f, 0.0f),
                                  glm::vec3(0.0f, 1.0f, 0.0f));
     glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f/600.0f, 0.1f, 100.0f);
+    textureStreamer.viewPosition = cameraPos;
+    textureStreamer.pixelsPerUnit = projection[1][1] * 600.0f * 0.5f;
     
     glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
     float near_plane = 1.0f, far_plane = 20.0f;
@@ -385,88 +7497,135 @@ int main()
                                       glm::vec3(0.0f, 1.0f, 0.0f));
     glm::mat4 lightSpaceMatrix = lightProjection * lightView;
     
-    glUseProgram(finalShaderProgram);
-    glUniformMatrix4fv(glGetUniformLocation(finalShaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-    
-    glUniform3f(glGetUniformLocation(finalShaderProgram, "lightPos"), lightPos.x, lightPos.y, lightPos.z);
-    glUniform3f(glGetUniformLocation(finalShaderProgram, "viewPos"), cameraPos.x, cameraPos.y, cameraPos.z);
-    glUniform3f(glGetUniformLocation(finalShaderProgram, "lightColor"), 1.0f, 1.0f, 1.0f);
-    glUniform3f(glGetUniformLocation(finalShaderProgram, "objectColor"), 1.0f, 0.5f, 0.31f);
-    
-    glUseProgram(finalShaderProgram);
-    glUniform1i(glGetUniformLocation(finalShaderProgram, "shadowMap"), 1);
+    createSceneUniforms();
     
+    if (asyncLoading)
+        startAssetLoader(window);
     Renderable cubeRenderable = loadRenderable("assets/cube.obj", "assets/concrete.png");
     Renderable brickRenderable = loadRenderable("assets/cube.obj", "assets/brick.png");
     Renderable duckRenderable = loadRenderable("assets/duck.obj", "assets/duck.jpg");
     
+    EntityStore scene;
+    createRenderableEntity(scene, COMPONENT_CASTS_SHADOW, cubeRenderable,
+                           glm::vec3(0.0f, -2.0f, 0.0f),
+                           glm::vec3(90.0f, 0.0f, 0.0f),
+                           glm::vec3(20.0f, 20.0f, 0.1f));
+    createRenderableEntity(scene, COMPONENT_CASTS_SHADOW, brickRenderable,
+                           glm::vec3(-4.0f, -1.0f, -10.0f),
+                           glm::vec3(90.0f, 0.0f, 0.0f),
+                           glm::vec3(1.0f, 14.0f, 5.0f));
+    uint32_t duckEntity = createRenderableEntity(scene, COMPONENT_CASTS_SHADOW, duckRenderable,
+                                                 glm::vec3(0.0f, -2.0f, 0.0f),
+                                                 glm::vec3(0.0f, 80.0f, 0.0f),
+                                                 glm::vec3(2.0f, 2.0f, 2.0f));
+    std::vector<DrawItem> shadowDraws, sceneDraws;
+    
     glfwSwapInterval(0);
     double lastTime = glfwGetTime();
     int frameCount = 0;
     
+    bool firstFrame = true;
+    bool assetsResident = !asyncLoading;
+    double worstLoadingFrame = 0.0;
+    
     while (!glfwWindowShouldClose(window))
     {
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        glUseProgram(depthShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(depthShaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+        auto frameStart = std::chrono::steady_clock::now();
+        if (asyncLoading)
+            pumpAssetUploads(uploadBudgetBytes);
+        pollShaderVariants(sceneShaders);
         
-        renderObjDepth(depthShaderProgram, cubeRenderable,
-                       glm::vec3(0.0f, -2.0f, 0.0f),
-                       glm::vec3(90.0f, 0.0f, 0.0f),
-                       glm::vec3(20.0f, 20.0f, 0.1f));
-        renderObjDepth(depthShaderProgram, brickRenderable,
-                       glm::vec3(-4.0f, -1.0f, -10.0f),
-                       glm::vec3(90.0f, 0.0f, 0.0f),
-                       glm::vec3(1.0f, 14.0f, 5.0f));
+        setFrameUniforms(view, projection, cameraPos);
+        setLightUniforms(lightSpaceMatrix, lightPos, glm::vec3(1.0f, 1.0f, 1.0f));
+        flushSceneUniforms();
         float duckX = sin(glfwGetTime() * 0.5f) * 5.0f;
-        renderObjDepth(depthShaderProgram, duckRenderable,
-                       glm::vec3(duckX, -2.0f, 0.0f),
-                       glm::vec3(0.0f, 80.0f, 0.0f),
-                       glm::vec3(2.0f, 2.0f, 2.0f));
+        setEntityPosition(scene, duckEntity, glm::vec3(duckX, -2.0f, 0.0f));
+        updateEntityTransforms(scene);
+        buildDrawList(scene, projection * view, 0, sceneDraws);
+        
+        if (renderShadows)
+        {
+            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            useShaderProgram(depthShaderProgram);
+            
+            buildDrawList(scene, lightSpaceMatrix, COMPONENT_CASTS_SHADOW, shadowDraws);
+            for (const DrawItem &item : shadowDraws)
+                renderObjDepth(depthShaderProgram, item.renderable, *item.world);
+            
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
         
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!virtualTextures.textures.empty())
+        {
+            beginVirtualTextureFeedback(feedbackShaderProgram);
+            for (const DrawItem &item : sceneDraws)
+                renderObjFeedback(feedbackShaderProgram, item.renderable, *item.world);
+            endVirtualTextureFeedback();
+            updateVirtualPageTables();
+        }
         
         glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
         glViewport(0, 0, 800, 600);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(finalShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(finalShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(finalShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(finalShaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-        glUniform3f(glGetUniformLocation(finalShaderProgram, "lightPos"), lightPos.x, lightPos.y, lightPos.z);
-        glUniform3f(glGetUniformLocation(finalShaderProgram, "viewPos"), cameraPos.x, cameraPos.y, cameraPos.z);
         
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D, depthMap);
+        if (!virtualTextures.textures.empty())
+            bindVirtualTextureCache();
         
-        renderObj(finalShaderProgram, cubeRenderable,
-                  glm::vec3(0.0f, -2.0f, 0.0f),
-                  glm::vec3(90.0f, 0.0f, 0.0f),
-                  glm::vec3(20.0f, 20.0f, 0.1f));
-        renderObj(finalShaderProgram, brickRenderable,
-                  glm::vec3(-4.0f, -1.0f, -10.0f),
-                  glm::vec3(90.0f, 0.0f, 0.0f),
-                  glm::vec3(1.0f, 14.0f, 5.0f));
-        renderObj(finalShaderProgram, duckRenderable,
-                  glm::vec3(duckX, -2.0f, 0.0f),
-                  glm::vec3(0.0f, 80.0f, 0.0f),
-                  glm::vec3(2.0f, 2.0f, 2.0f));
+        renderDrawList(sceneShaders, sceneDraws, scene.stats);
+        updateTextureStreaming();
         
         glfwSwapBuffers(window);
         glfwPollEvents();
         
+        auto frameEnd = std::chrono::steady_clock::now();
+        if (!firstFrame && !assetsResident)
+            worstLoadingFrame = std::max(worstLoadingFrame, std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+        if (firstFrame || (!assetsResident && loader.pending == 0))
+        {
+            double elapsed = std::chrono::duration<double, std::milli>(frameEnd - startTime).count();
+            if (firstFrame)
+                std::cout << "First frame after " << elapsed << " ms" << std::endl;
+            if (!assetsResident && loader.pending == 0)
+                std::cout << "All assets resident after " << elapsed << " ms (worst frame while loading: "
+                          << worstLoadingFrame << " ms)" << std::endl;
+            if (loader.pending == 0)
+            {
+                reportAssetPool("meshes", assets.meshes);
+                reportAssetPool("textures", assets.textures);
+                std::cout << "Shader programs: " << programCache.loaded << " from the binary cache, "
+                          << programCache.compiled << " compiled (" << programCache.rejected << " binaries rejected)"
+                          << std::endl;
+            }
+            firstFrame = false;
+            assetsResident = loader.pending == 0;
+        }
+        
         double currentTime = glfwGetTime();
         frameCount++;
         if (currentTime - lastTime >= 1.0)
         {
             std::cout << "FPS: " << frameCount << std::endl;
+            reportUniformStats();
+            reportEntityStore(scene);
+            reportTextureStreaming();
+            reportVirtualTextures();
             frameCount = 0;
             lastTime = currentTime;
         }
     }
     
+    if (asyncLoading)
+        stopAssetLoader();
+    releaseRenderable(cubeRenderable);
+    releaseRenderable(brickRenderable);
+    releaseRenderable(duckRenderable);
+    destroyVirtualTextures();
+    destroySceneUniforms();
+    destroyShaderVariants(sceneShaders);
     glfwTerminate();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#!/usr/bin/env bash
+# Offline shader optimization. Exports every shader stage from the built
+# binary, compiles each to SPIR-V with glslang, runs the spirv-opt
+# performance passes, cross-compiles back to GLSL 330 with SPIRV-Cross and
+# writes src/optimized_shaders.h, which main.cpp embeds on the next build
+# and uses when run with --optimized-shaders.
+#
+# Fragment ALU counts before and after spirv-opt go to
+# build/shaders/alu_counts.txt (malioc cycle estimates too, when it is on
+# PATH). The count is of SPIR-V arithmetic instructions, a proxy for what the
+# driver compiler ends up emitting.
+#
+# Run from the repository root after a build:
+#   tools/optimize_shaders.sh [path/to/main.exe]
+# The tools come with the Vulkan SDK. Without --optimized-shaders (or with
+# src/optimized_shaders.h deleted) the embedded GLSL is compiled as written.
+set -euo pipefail
+
+MAIN=${1:-bin/main.exe}
+WORK=build/shaders
+HEADER=src/optimized_shaders.h
+
+for tool in glslangValidator spirv-opt spirv-cross spirv-dis; do
+    if ! command -v "$tool" > /dev/null; then
+        echo "$tool not found; install the Vulkan SDK" >&2
+        exit 1
+    fi
+done
+
+rm -rf "$WORK"
+mkdir -p "$WORK/glsl" "$WORK/spv" "$WORK/opt"
+"$MAIN" --export-shaders "$WORK/glsl"
+
+# Arithmetic, comparison, conversion and GLSL.std.450 instructions.
+ALU_OPS='Op(F|I|S|U)(Add|Sub|Mul|Div|Mod|Rem|Negate)|OpDot|OpVectorTimes|OpMatrixTimes|OpOuterProduct|OpExtInst|OpF(Ord|Unord)|OpI(Equal|NotEqual)|Op(S|U)(LessThan|GreaterThan)|OpSelect|OpConvert|OpBitwise|OpShift'
+
+aluCount()
+{
+    spirv-dis "$1" | grep -cE "= ($ALU_OPS)" || true
+}
+
+maliCycles()
+{
+    malioc --fragment "$1" 2>/dev/null | grep -m1 'Shortest path' | tr -s ' ' || true
+}
+
+printf '%-52s %8s %8s\n' stage before after > "$WORK/alu_counts.txt"
+for src in "$WORK"/glsl/*; do
+    name=$(basename "$src")
+    # Loose uniforms and varyings need locations in SPIR-V; SPIRV-Cross
+    # drops them again for GLSL 330, which links them by name.
+    glslangValidator -G --auto-map-locations --auto-map-bindings -o "$WORK/spv/$name.spv" "$src" > /dev/null
+    spirv-opt -O "$WORK/spv/$name.spv" -o "$WORK/opt/$name.spv"
+    spirv-cross --version 330 --no-es --no-420pack-extension --output "$WORK/opt/$name" "$WORK/opt/$name.spv"
+    # Uniform locations would need GL_ARB_explicit_uniform_location; the
+    # renderer looks every uniform up by name anyway.
+    sed -i -E -e '/GL_ARB_explicit_uniform_location/d' \
+        -e 's/^layout\(location = [0-9]+\) uniform /uniform /' "$WORK/opt/$name"
+
+    if [[ $name == *.frag ]]; then
+        printf '%-52s %8s %8s\n' "$name" "$(aluCount "$WORK/spv/$name.spv")" \
+            "$(aluCount "$WORK/opt/$name.spv")" >> "$WORK/alu_counts.txt"
+        if command -v malioc > /dev/null; then
+            echo "  malioc before: $(maliCycles "$src")" >> "$WORK/alu_counts.txt"
+            echo "  malioc after:  $(maliCycles "$WORK/opt/$name")" >> "$WORK/alu_counts.txt"
+        fi
+    fi
+done
+
+{
+    echo "// Generated by tools/optimize_shaders.sh; do not edit."
+    echo "struct OptimizedShader {"
+    echo "    const char *name;"
+    echo "    const char *source;"
+    echo "};"
+    echo
+    echo "const OptimizedShader OPTIMIZED_SHADERS[] = {"
+    for src in "$WORK"/opt/*.vert "$WORK"/opt/*.frag; do
+        printf '    {"%s", R"GLSL(' "$(basename "$src")"
+        cat "$src"
+        echo ")GLSL\"},"
+    done
+    echo "};"
+} > "$HEADER"
+
+cat "$WORK/alu_counts.txt"
+echo "Wrote $HEADER; rebuild to embed it and run with --optimized-shaders."